@@ -0,0 +1,140 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "AudioSampleConversion.h"
+#include "Math/VectorRegister.h"
+
+namespace AudioSampleConversion
+{
+	/** -3 dB, how much of the center and surround channels goes into each side of a stereo downmix. */
+	static constexpr float SideGain = 0.7071068f;
+
+	static FORCEINLINE VectorRegister ClampVector(const VectorRegister& Value)
+	{
+		return VectorMin(VectorMax(Value, VectorSetFloat1(-1.f)), VectorSetFloat1(1.f));
+	}
+
+	static FORCEINLINE float ClampSample(float Value)
+	{
+		return FMath::Clamp(Value, -1.f, 1.f);
+	}
+
+	static void StereoToStereo(const float* Src, int32 NumFrames, float* Left, float* Right)
+	{
+		int32 Frame = 0;
+
+		for (; Frame + 4 <= NumFrames; Frame += 4)
+		{
+			// L0 R0 L1 R1 | L2 R2 L3 R3 -> L0 L1 L2 L3 | R0 R1 R2 R3
+			const VectorRegister First = VectorLoad(Src + Frame * 2);
+			const VectorRegister Second = VectorLoad(Src + Frame * 2 + 4);
+
+			VectorStore(ClampVector(VectorShuffle(First, Second, 0, 2, 0, 2)), Left + Frame);
+			VectorStore(ClampVector(VectorShuffle(First, Second, 1, 3, 1, 3)), Right + Frame);
+		}
+
+		for (; Frame < NumFrames; Frame++)
+		{
+			Left[Frame] = ClampSample(Src[Frame * 2]);
+			Right[Frame] = ClampSample(Src[Frame * 2 + 1]);
+		}
+	}
+
+	static void MonoToPlanes(const float* Src, int32 NumFrames, float* const Dst[], int32 DstChannels)
+	{
+		int32 Frame = 0;
+
+		for (; Frame + 4 <= NumFrames; Frame += 4)
+		{
+			const VectorRegister Samples = ClampVector(VectorLoad(Src + Frame));
+
+			for (int32 Channel = 0; Channel < DstChannels; Channel++)
+			{
+				VectorStore(Samples, Dst[Channel] + Frame);
+			}
+		}
+
+		for (; Frame < NumFrames; Frame++)
+		{
+			const float Sample = ClampSample(Src[Frame]);
+
+			for (int32 Channel = 0; Channel < DstChannels; Channel++)
+			{
+				Dst[Channel][Frame] = Sample;
+			}
+		}
+	}
+
+	/**
+	 * Left / right gains of every source channel, in the audio mixer's channel order
+	 * (FL, FR, FC, LFE, SL, SR, BL, BR). The LFE is dropped and the result normalized so a full scale input cannot clip.
+	 */
+	static void GetStereoDownmixGains(int32 SrcChannels, float OutGains[MaxSourceChannels][2])
+	{
+		static const float SurroundGains[MaxSourceChannels][2] = {
+			{ 1.f, 0.f }, { 0.f, 1.f }, { SideGain, SideGain }, { 0.f, 0.f },
+			{ SideGain, 0.f }, { 0.f, SideGain }, { SideGain, 0.f }, { 0.f, SideGain },
+		};
+
+		float Sum = 0.f;
+
+		for (int32 Channel = 0; Channel < SrcChannels; Channel++)
+		{
+			// Layouts without a center / LFE pair (quad) just alternate left and right.
+			const bool bSurroundLayout = SrcChannels >= 5;
+			OutGains[Channel][0] = bSurroundLayout ? SurroundGains[Channel][0] : float(Channel % 2 == 0);
+			OutGains[Channel][1] = bSurroundLayout ? SurroundGains[Channel][1] : float(Channel % 2 == 1);
+			Sum += OutGains[Channel][0];
+		}
+
+		for (int32 Channel = 0; Channel < SrcChannels; Channel++)
+		{
+			OutGains[Channel][0] /= Sum;
+			OutGains[Channel][1] /= Sum;
+		}
+	}
+
+	static void Downmix(const float* Src, int32 NumFrames, int32 SrcChannels, float* const Dst[], int32 DstChannels)
+	{
+		const int32 MixedChannels = FMath::Min(SrcChannels, MaxSourceChannels);
+
+		float Gains[MaxSourceChannels][2];
+		GetStereoDownmixGains(MixedChannels, Gains);
+
+		for (int32 Frame = 0; Frame < NumFrames; Frame++)
+		{
+			const float* Samples = Src + Frame * SrcChannels;
+
+			float Left = 0.f;
+			float Right = 0.f;
+			for (int32 Channel = 0; Channel < MixedChannels; Channel++)
+			{
+				Left += Samples[Channel] * Gains[Channel][0];
+				Right += Samples[Channel] * Gains[Channel][1];
+			}
+
+			if (DstChannels == 1) {
+				Dst[0][Frame] = ClampSample((Left + Right) * 0.5f);
+			}
+			else {
+				Dst[0][Frame] = ClampSample(Left);
+				Dst[1][Frame] = ClampSample(Right);
+			}
+		}
+	}
+
+	void DeinterleaveToPlanar(const float* Src, int32 NumFrames, int32 SrcChannels, float* const Dst[], int32 DstChannels)
+	{
+		check(DstChannels == 1 || DstChannels == 2);
+
+		if (SrcChannels == 2 && DstChannels == 2) {
+			StereoToStereo(Src, NumFrames, Dst[0], Dst[1]);
+		}
+		else if (SrcChannels == 1) {
+			MonoToPlanes(Src, NumFrames, Dst, DstChannels);
+		}
+		else {
+			Downmix(Src, NumFrames, SrcChannels, Dst, DstChannels);
+		}
+	}
+}
@@ -0,0 +1,21 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Converts the interleaved float submix output into the planar float layout (AV_SAMPLE_FMT_FLTP) the audio encoder
+ * takes, with channel mapping and clamping done in the same pass. Allocation free, safe on the audio render thread.
+ */
+namespace AudioSampleConversion
+{
+	/** Submix channel layouts above this are not mixed in, the audio mixer never outputs more than 7.1. */
+	static constexpr int32 MaxSourceChannels = 8;
+
+	/**
+	 * Deinterleaves NumFrames frames of SrcChannels interleaved samples into DstChannels (1 or 2) planes, downmixing
+	 * or duplicating channels as needed and clamping every sample to [-1, 1].
+	 */
+	void DeinterleaveToPlanar(const float* Src, int32 NumFrames, int32 SrcChannels, float* const Dst[], int32 DstChannels);
+}
@@ -0,0 +1,563 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "CaptureColorConversion.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+extern "C" {
+#include "libswscale/swscale.h"
+}
+
+#if CAPTURE_CORE_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC compiles AVX2 intrinsics anywhere, gcc and clang need the functions using them to opt in.
+#if CAPTURE_CORE_X86 && (defined(__GNUC__) || defined(__clang__))
+#define CAPTURE_CORE_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define CAPTURE_CORE_TARGET_AVX2
+#endif
+
+#if defined(_MSC_VER)
+#define CAPTURE_CORE_FORCEINLINE __forceinline
+#else
+#define CAPTURE_CORE_FORCEINLINE inline __attribute__((always_inline))
+#endif
+
+namespace CaptureColorConversion
+{
+	/** Fixed point precision of the coefficients. */
+	static constexpr int32_t CoefficientShift = 14;
+
+	/** Below this a band is not worth a task of its own. */
+	static constexpr int32_t MinRowPairsPerSlice = 32;
+
+	/** Integer matrix for one color space and range, each row ordered B, G, R like the pixel bytes. */
+	struct FCoefficients
+	{
+		int16_t Y[3];
+		int16_t U[3];
+		int16_t V[3];
+		int32_t YOffset;
+	};
+
+	/**
+	 * Converts two source rows into two luma rows and one chroma row, starting at column X (even).
+	 * Returns the column it stopped at, the scalar kernel then finishes the remaining columns.
+	 */
+	typedef int32_t (*FConvertRowPairFunction)(const uint8_t* Row0, const uint8_t* Row1, int32_t X, int32_t Width,
+		uint8_t* Y0, uint8_t* Y1, uint8_t* U, uint8_t* V, int32_t UVStep, const FCoefficients& C);
+
+	/** Upper bound of the bands a frame is split into, the hash keeps one result per band on the stack. */
+	static constexpr int32_t MaxSlices = 64;
+
+	static FCoefficients MakeCoefficients(AVColorSpace ColorSpace, bool bFullRange)
+	{
+		const double Kr = ColorSpace == AVCOL_SPC_BT709 ? 0.2126 : 0.299;
+		const double Kb = ColorSpace == AVCOL_SPC_BT709 ? 0.0722 : 0.114;
+
+		const double Scale = double(1 << CoefficientShift);
+		const double YScale = (bFullRange ? 255.0 : 219.0) / 255.0 * Scale;
+		const double CbScale = (bFullRange ? 255.0 : 224.0) / 255.0 / (2.0 * (1.0 - Kb)) * Scale;
+		const double CrScale = (bFullRange ? 255.0 : 224.0) / 255.0 / (2.0 * (1.0 - Kr)) * Scale;
+
+		FCoefficients C;
+
+		// Green is derived from the other two so that every row sums exactly to white and gray maps to 128 chroma.
+		C.Y[0] = int16_t(std::lround(Kb * YScale));
+		C.Y[2] = int16_t(std::lround(Kr * YScale));
+		C.Y[1] = int16_t(std::lround(YScale) - C.Y[0] - C.Y[2]);
+
+		C.U[0] = int16_t(std::lround((1.0 - Kb) * CbScale));
+		C.U[2] = int16_t(std::lround(-Kr * CbScale));
+		C.U[1] = int16_t(-C.U[0] - C.U[2]);
+
+		C.V[0] = int16_t(std::lround(-Kb * CrScale));
+		C.V[2] = int16_t(std::lround((1.0 - Kr) * CrScale));
+		C.V[1] = int16_t(-C.V[0] - C.V[2]);
+
+		C.YOffset = bFullRange ? 0 : 16;
+
+		return C;
+	}
+
+	static CAPTURE_CORE_FORCEINLINE uint8_t ClampToByte(int32_t Value)
+	{
+		return uint8_t(std::min(std::max(Value, 0), 255));
+	}
+
+	static CAPTURE_CORE_FORCEINLINE uint8_t LumaScalar(const uint8_t* Pixel, const FCoefficients& C)
+	{
+		return ClampToByte((C.Y[0] * Pixel[0] + C.Y[1] * Pixel[1] + C.Y[2] * Pixel[2] + (C.YOffset << CoefficientShift) + (1 << (CoefficientShift - 1))) >> CoefficientShift);
+	}
+
+	/** Chroma from the sums of a 2x2 block, which is why it shifts by two more bits. */
+	static CAPTURE_CORE_FORCEINLINE uint8_t ChromaScalar(int32_t B, int32_t G, int32_t R, const int16_t Coeffs[3])
+	{
+		return ClampToByte((Coeffs[0] * B + Coeffs[1] * G + Coeffs[2] * R + (128 << (CoefficientShift + 2)) + (1 << (CoefficientShift + 1))) >> (CoefficientShift + 2));
+	}
+
+	/** Reference kernel. Also handles odd widths by repeating the last column. */
+	static int32_t ConvertRowPairScalar(const uint8_t* Row0, const uint8_t* Row1, int32_t X, int32_t Width,
+		uint8_t* Y0, uint8_t* Y1, uint8_t* U, uint8_t* V, int32_t UVStep, const FCoefficients& C)
+	{
+		for (; X < Width; X += 2)
+		{
+			const int32_t X1 = std::min(X + 1, Width - 1);
+
+			const uint8_t* P00 = Row0 + X * 4;
+			const uint8_t* P01 = Row0 + X1 * 4;
+			const uint8_t* P10 = Row1 + X * 4;
+			const uint8_t* P11 = Row1 + X1 * 4;
+
+			Y0[X] = LumaScalar(P00, C);
+			Y0[X1] = LumaScalar(P01, C);
+			Y1[X] = LumaScalar(P10, C);
+			Y1[X1] = LumaScalar(P11, C);
+
+			const int32_t B = P00[0] + P01[0] + P10[0] + P11[0];
+			const int32_t G = P00[1] + P01[1] + P10[1] + P11[1];
+			const int32_t R = P00[2] + P01[2] + P10[2] + P11[2];
+
+			U[(X / 2) * UVStep] = ChromaScalar(B, G, R, C.U);
+			V[(X / 2) * UVStep] = ChromaScalar(B, G, R, C.V);
+		}
+
+		return Width;
+	}
+
+#if CAPTURE_CORE_X86
+	/** [a0 a1 a2 a3], [b0 b1 b2 b3] -> [a0+a1 a2+a3 b0+b1 b2+b3], per 128 bit lane. */
+	static CAPTURE_CORE_FORCEINLINE __m128i SumPairs_SSE2(__m128i A, __m128i B)
+	{
+		const __m128 FA = _mm_castsi128_ps(A);
+		const __m128 FB = _mm_castsi128_ps(B);
+
+		return _mm_add_epi32(
+			_mm_castps_si128(_mm_shuffle_ps(FA, FB, _MM_SHUFFLE(2, 0, 2, 0))),
+			_mm_castps_si128(_mm_shuffle_ps(FA, FB, _MM_SHUFFLE(3, 1, 3, 1))));
+	}
+
+	/** Dot product of 4 BGRA pixels with [B G R 0] coefficients, one int32_t per pixel. */
+	static CAPTURE_CORE_FORCEINLINE __m128i DotBGRA_SSE2(__m128i Pixels, __m128i Coeffs)
+	{
+		const __m128i Zero = _mm_setzero_si128();
+
+		return SumPairs_SSE2(
+			_mm_madd_epi16(_mm_unpacklo_epi8(Pixels, Zero), Coeffs),
+			_mm_madd_epi16(_mm_unpackhi_epi8(Pixels, Zero), Coeffs));
+	}
+
+	/** 4 pixels of two rows -> the BGRA sums of their two 2x2 blocks as int16_t. */
+	static CAPTURE_CORE_FORCEINLINE __m128i BlockSums_SSE2(__m128i Row0, __m128i Row1)
+	{
+		const __m128i Zero = _mm_setzero_si128();
+		const __m128i Lo = _mm_add_epi16(_mm_unpacklo_epi8(Row0, Zero), _mm_unpacklo_epi8(Row1, Zero));
+		const __m128i Hi = _mm_add_epi16(_mm_unpackhi_epi8(Row0, Zero), _mm_unpackhi_epi8(Row1, Zero));
+
+		return _mm_unpacklo_epi64(
+			_mm_add_epi16(Lo, _mm_shuffle_epi32(Lo, _MM_SHUFFLE(1, 0, 3, 2))),
+			_mm_add_epi16(Hi, _mm_shuffle_epi32(Hi, _MM_SHUFFLE(1, 0, 3, 2))));
+	}
+
+	static CAPTURE_CORE_FORCEINLINE void StoreLuma_SSE2(uint8_t* Dst, __m128i Pixels0, __m128i Pixels1, __m128i Coeffs, __m128i Bias)
+	{
+		const __m128i Lo = _mm_srai_epi32(_mm_add_epi32(DotBGRA_SSE2(Pixels0, Coeffs), Bias), CoefficientShift);
+		const __m128i Hi = _mm_srai_epi32(_mm_add_epi32(DotBGRA_SSE2(Pixels1, Coeffs), Bias), CoefficientShift);
+		const __m128i Luma = _mm_packs_epi32(Lo, Hi);
+
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(Dst), _mm_packus_epi16(Luma, Luma));
+	}
+
+	/** 8 pixels per iteration. */
+	static int32_t ConvertRowPairSSE2(const uint8_t* Row0, const uint8_t* Row1, int32_t X, int32_t Width,
+		uint8_t* Y0, uint8_t* Y1, uint8_t* U, uint8_t* V, int32_t UVStep, const FCoefficients& C)
+	{
+		const __m128i YCoeffs = _mm_setr_epi16(C.Y[0], C.Y[1], C.Y[2], 0, C.Y[0], C.Y[1], C.Y[2], 0);
+		const __m128i UCoeffs = _mm_setr_epi16(C.U[0], C.U[1], C.U[2], 0, C.U[0], C.U[1], C.U[2], 0);
+		const __m128i VCoeffs = _mm_setr_epi16(C.V[0], C.V[1], C.V[2], 0, C.V[0], C.V[1], C.V[2], 0);
+		const __m128i YBias = _mm_set1_epi32((C.YOffset << CoefficientShift) + (1 << (CoefficientShift - 1)));
+		const __m128i CBias = _mm_set1_epi32((128 << (CoefficientShift + 2)) + (1 << (CoefficientShift + 1)));
+
+		for (; X + 8 <= Width; X += 8)
+		{
+			const __m128i A0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Row0 + X * 4));
+			const __m128i B0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Row0 + X * 4 + 16));
+			const __m128i A1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Row1 + X * 4));
+			const __m128i B1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Row1 + X * 4 + 16));
+
+			StoreLuma_SSE2(Y0 + X, A0, B0, YCoeffs, YBias);
+			StoreLuma_SSE2(Y1 + X, A1, B1, YCoeffs, YBias);
+
+			const __m128i Blocks0 = BlockSums_SSE2(A0, A1);
+			const __m128i Blocks1 = BlockSums_SSE2(B0, B1);
+
+			const __m128i UValues = _mm_srai_epi32(_mm_add_epi32(SumPairs_SSE2(_mm_madd_epi16(Blocks0, UCoeffs), _mm_madd_epi16(Blocks1, UCoeffs)), CBias), CoefficientShift + 2);
+			const __m128i VValues = _mm_srai_epi32(_mm_add_epi32(SumPairs_SSE2(_mm_madd_epi16(Blocks0, VCoeffs), _mm_madd_epi16(Blocks1, VCoeffs)), CBias), CoefficientShift + 2);
+
+			const __m128i Chroma = _mm_packus_epi16(_mm_packs_epi32(UValues, VValues), _mm_setzero_si128());
+
+			if (UVStep == 1)
+			{
+				const int32_t UBytes = _mm_cvtsi128_si32(Chroma);
+				const int32_t VBytes = _mm_cvtsi128_si32(_mm_srli_si128(Chroma, 4));
+				memcpy(U + X / 2, &UBytes, 4);
+				memcpy(V + X / 2, &VBytes, 4);
+			}
+			else
+			{
+				_mm_storel_epi64(reinterpret_cast<__m128i*>(U + X), _mm_unpacklo_epi8(Chroma, _mm_srli_si128(Chroma, 4)));
+			}
+		}
+
+		return X;
+	}
+
+	CAPTURE_CORE_TARGET_AVX2 static CAPTURE_CORE_FORCEINLINE __m256i SumPairs_AVX2(__m256i A, __m256i B)
+	{
+		const __m256 FA = _mm256_castsi256_ps(A);
+		const __m256 FB = _mm256_castsi256_ps(B);
+
+		return _mm256_add_epi32(
+			_mm256_castps_si256(_mm256_shuffle_ps(FA, FB, _MM_SHUFFLE(2, 0, 2, 0))),
+			_mm256_castps_si256(_mm256_shuffle_ps(FA, FB, _MM_SHUFFLE(3, 1, 3, 1))));
+	}
+
+	CAPTURE_CORE_TARGET_AVX2 static CAPTURE_CORE_FORCEINLINE __m256i DotBGRA_AVX2(__m256i Pixels, __m256i Coeffs)
+	{
+		const __m256i Zero = _mm256_setzero_si256();
+
+		return SumPairs_AVX2(
+			_mm256_madd_epi16(_mm256_unpacklo_epi8(Pixels, Zero), Coeffs),
+			_mm256_madd_epi16(_mm256_unpackhi_epi8(Pixels, Zero), Coeffs));
+	}
+
+	CAPTURE_CORE_TARGET_AVX2 static CAPTURE_CORE_FORCEINLINE __m256i BlockSums_AVX2(__m256i Row0, __m256i Row1)
+	{
+		const __m256i Zero = _mm256_setzero_si256();
+		const __m256i Lo = _mm256_add_epi16(_mm256_unpacklo_epi8(Row0, Zero), _mm256_unpacklo_epi8(Row1, Zero));
+		const __m256i Hi = _mm256_add_epi16(_mm256_unpackhi_epi8(Row0, Zero), _mm256_unpackhi_epi8(Row1, Zero));
+
+		return _mm256_unpacklo_epi64(
+			_mm256_add_epi16(Lo, _mm256_shuffle_epi32(Lo, _MM_SHUFFLE(1, 0, 3, 2))),
+			_mm256_add_epi16(Hi, _mm256_shuffle_epi32(Hi, _MM_SHUFFLE(1, 0, 3, 2))));
+	}
+
+	/** Everything above works inside 128 bit lanes, this puts the four 64 bit quarters produced from two inputs back in pixel order. */
+	CAPTURE_CORE_TARGET_AVX2 static CAPTURE_CORE_FORCEINLINE __m256i ReorderLanes_AVX2(__m256i Value)
+	{
+		return _mm256_permute4x64_epi64(Value, _MM_SHUFFLE(3, 1, 2, 0));
+	}
+
+	CAPTURE_CORE_TARGET_AVX2 static CAPTURE_CORE_FORCEINLINE void StoreLuma_AVX2(uint8_t* Dst, __m256i Pixels0, __m256i Pixels1, __m256i Coeffs, __m256i Bias)
+	{
+		const __m256i Lo = _mm256_srai_epi32(_mm256_add_epi32(DotBGRA_AVX2(Pixels0, Coeffs), Bias), CoefficientShift);
+		const __m256i Hi = _mm256_srai_epi32(_mm256_add_epi32(DotBGRA_AVX2(Pixels1, Coeffs), Bias), CoefficientShift);
+		const __m256i Luma = ReorderLanes_AVX2(_mm256_packs_epi32(Lo, Hi));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(Dst), _mm_packus_epi16(_mm256_castsi256_si128(Luma), _mm256_extracti128_si256(Luma, 1)));
+	}
+
+	/** 16 pixels per iteration. */
+	CAPTURE_CORE_TARGET_AVX2 static int32_t ConvertRowPairAVX2(const uint8_t* Row0, const uint8_t* Row1, int32_t X, int32_t Width,
+		uint8_t* Y0, uint8_t* Y1, uint8_t* U, uint8_t* V, int32_t UVStep, const FCoefficients& C)
+	{
+		const __m256i YCoeffs = _mm256_setr_epi16(C.Y[0], C.Y[1], C.Y[2], 0, C.Y[0], C.Y[1], C.Y[2], 0, C.Y[0], C.Y[1], C.Y[2], 0, C.Y[0], C.Y[1], C.Y[2], 0);
+		const __m256i UCoeffs = _mm256_setr_epi16(C.U[0], C.U[1], C.U[2], 0, C.U[0], C.U[1], C.U[2], 0, C.U[0], C.U[1], C.U[2], 0, C.U[0], C.U[1], C.U[2], 0);
+		const __m256i VCoeffs = _mm256_setr_epi16(C.V[0], C.V[1], C.V[2], 0, C.V[0], C.V[1], C.V[2], 0, C.V[0], C.V[1], C.V[2], 0, C.V[0], C.V[1], C.V[2], 0);
+		const __m256i YBias = _mm256_set1_epi32((C.YOffset << CoefficientShift) + (1 << (CoefficientShift - 1)));
+		const __m256i CBias = _mm256_set1_epi32((128 << (CoefficientShift + 2)) + (1 << (CoefficientShift + 1)));
+
+		for (; X + 16 <= Width; X += 16)
+		{
+			const __m256i A0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(Row0 + X * 4));
+			const __m256i B0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(Row0 + X * 4 + 32));
+			const __m256i A1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(Row1 + X * 4));
+			const __m256i B1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(Row1 + X * 4 + 32));
+
+			StoreLuma_AVX2(Y0 + X, A0, B0, YCoeffs, YBias);
+			StoreLuma_AVX2(Y1 + X, A1, B1, YCoeffs, YBias);
+
+			const __m256i Blocks0 = BlockSums_AVX2(A0, A1);
+			const __m256i Blocks1 = BlockSums_AVX2(B0, B1);
+
+			const __m256i UValues = ReorderLanes_AVX2(_mm256_srai_epi32(_mm256_add_epi32(SumPairs_AVX2(_mm256_madd_epi16(Blocks0, UCoeffs), _mm256_madd_epi16(Blocks1, UCoeffs)), CBias), CoefficientShift + 2));
+			const __m256i VValues = ReorderLanes_AVX2(_mm256_srai_epi32(_mm256_add_epi32(SumPairs_AVX2(_mm256_madd_epi16(Blocks0, VCoeffs), _mm256_madd_epi16(Blocks1, VCoeffs)), CBias), CoefficientShift + 2));
+
+			const __m128i UWords = _mm_packs_epi32(_mm256_castsi256_si128(UValues), _mm256_extracti128_si256(UValues, 1));
+			const __m128i VWords = _mm_packs_epi32(_mm256_castsi256_si128(VValues), _mm256_extracti128_si256(VValues, 1));
+			const __m128i Chroma = _mm_packus_epi16(UWords, VWords);
+
+			if (UVStep == 1)
+			{
+				_mm_storel_epi64(reinterpret_cast<__m128i*>(U + X / 2), Chroma);
+				_mm_storel_epi64(reinterpret_cast<__m128i*>(V + X / 2), _mm_srli_si128(Chroma, 8));
+			}
+			else
+			{
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(U + X), _mm_unpacklo_epi8(Chroma, _mm_srli_si128(Chroma, 8)));
+			}
+		}
+
+		return X;
+	}
+
+	static bool HasAVX2Support()
+	{
+#if defined(_MSC_VER)
+		int32_t Info[4];
+		__cpuid(Info, 0);
+		if (Info[0] < 7) {
+			return false;
+		}
+
+		// AVX needs OS support for saving the ymm registers as well.
+		__cpuid(Info, 1);
+		const bool bOSXSave = (Info[2] & (1 << 27)) != 0;
+		const bool bAVX = (Info[2] & (1 << 28)) != 0;
+		if (!bOSXSave || !bAVX || (_xgetbv(0) & 6) != 6) {
+			return false;
+		}
+
+		__cpuidex(Info, 7, 0);
+		return (Info[1] & (1 << 5)) != 0;
+#elif defined(__GNUC__) || defined(__clang__)
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") != 0;
+#else
+		return false;
+#endif
+	}
+#endif
+
+	struct FKernel
+	{
+		FConvertRowPairFunction Function;
+		const char* Name;
+	};
+
+	/** Every kernel this CPU can run, the scalar reference first. */
+	static const std::vector<FKernel>& GetAvailableKernelList()
+	{
+		static const std::vector<FKernel> Kernels = []()
+		{
+			std::vector<FKernel> Result;
+			Result.push_back(FKernel{ &ConvertRowPairScalar, "Scalar" });
+#if CAPTURE_CORE_X86
+			Result.push_back(FKernel{ &ConvertRowPairSSE2, "SSE2" });
+			if (HasAVX2Support()) {
+				Result.push_back(FKernel{ &ConvertRowPairAVX2, "AVX2" });
+			}
+#endif
+			return Result;
+		}();
+
+		return Kernels;
+	}
+
+	/** The fastest one. */
+	static const FKernel& GetKernel()
+	{
+		return GetAvailableKernelList().back();
+	}
+
+	/** Runs Body for every slice, on ParallelFor when there is more than one and it was given. */
+	static void ForEachSlice(int32_t NumSlices, const FCaptureParallelFor& ParallelFor, const std::function<void(int32_t Slice)>& Body)
+	{
+		if (NumSlices == 1 || !ParallelFor) {
+			for (int32_t Slice = 0; Slice < NumSlices; Slice++)
+			{
+				Body(Slice);
+			}
+			return;
+		}
+
+		ParallelFor(NumSlices, Body);
+	}
+
+	static bool ConvertWithKernel(FConvertRowPairFunction Kernel, const uint8_t* Src, int32_t SrcPitch, int32_t Width, int32_t Height,
+		uint8_t* const Dst[], const int32_t DstPitch[], enum AVPixelFormat DstFormat, AVColorSpace ColorSpace, bool bFullRange, int32_t NumSlices, const FCaptureParallelFor& ParallelFor)
+	{
+		uint8_t* UPlane = nullptr;
+		uint8_t* VPlane = nullptr;
+		int32_t UPitch = 0;
+		int32_t VPitch = 0;
+		int32_t UVStep = 1;
+
+		switch (DstFormat)
+		{
+		case AV_PIX_FMT_YUV420P:
+			UPlane = Dst[1];
+			VPlane = Dst[2];
+			UPitch = DstPitch[1];
+			VPitch = DstPitch[2];
+			break;
+		case AV_PIX_FMT_NV12:
+			UPlane = Dst[1];
+			VPlane = Dst[1] + 1;
+			UPitch = DstPitch[1];
+			VPitch = DstPitch[1];
+			UVStep = 2;
+			break;
+		default:
+			return false;
+		}
+
+		const FCoefficients Coefficients = MakeCoefficients(ColorSpace, bFullRange);
+
+		// Bands are cut on row pairs so that no two slices ever write the same chroma row.
+		const int32_t NumRowPairs = (Height + 1) / 2;
+		NumSlices = std::min(std::max(NumSlices, 1), std::max(NumRowPairs / MinRowPairsPerSlice, 1));
+
+		ForEachSlice(NumSlices, ParallelFor, [&](int32_t Slice)
+		{
+			const int32_t FirstRowPair = NumRowPairs * Slice / NumSlices;
+			const int32_t LastRowPair = NumRowPairs * (Slice + 1) / NumSlices;
+
+			for (int32_t Row = FirstRowPair * 2; Row < LastRowPair * 2; Row += 2)
+			{
+				// An odd last row is averaged with itself.
+				const int32_t NextRow = std::min(Row + 1, Height - 1);
+
+				const uint8_t* Row0 = Src + Row * SrcPitch;
+				const uint8_t* Row1 = Src + NextRow * SrcPitch;
+				uint8_t* Y0 = Dst[0] + Row * DstPitch[0];
+				uint8_t* Y1 = Dst[0] + NextRow * DstPitch[0];
+				uint8_t* U = UPlane + (Row / 2) * UPitch;
+				uint8_t* V = VPlane + (Row / 2) * VPitch;
+
+				const int32_t X = Kernel(Row0, Row1, 0, Width, Y0, Y1, U, V, UVStep, Coefficients);
+				ConvertRowPairScalar(Row0, Row1, X, Width, Y0, Y1, U, V, UVStep, Coefficients);
+			}
+		});
+
+		return true;
+	}
+
+	bool IsFormatSupported(enum AVPixelFormat DstFormat)
+	{
+		return DstFormat == AV_PIX_FMT_YUV420P || DstFormat == AV_PIX_FMT_NV12;
+	}
+
+	bool ConvertBGRAToYUV(const uint8_t* Src, int32_t SrcPitch, int32_t Width, int32_t Height,
+		uint8_t* const Dst[], const int32_t DstPitch[], enum AVPixelFormat DstFormat, AVColorSpace ColorSpace, bool bFullRange, int32_t NumSlices, const FCaptureParallelFor& ParallelFor)
+	{
+		return ConvertWithKernel(GetKernel().Function, Src, SrcPitch, Width, Height, Dst, DstPitch, DstFormat, ColorSpace, bFullRange, NumSlices, ParallelFor);
+	}
+
+	bool ConvertBGRAToYUVWithKernel(const char* KernelName, const uint8_t* Src, int32_t SrcPitch, int32_t Width, int32_t Height,
+		uint8_t* const Dst[], const int32_t DstPitch[], enum AVPixelFormat DstFormat, AVColorSpace ColorSpace, bool bFullRange, int32_t NumSlices, const FCaptureParallelFor& ParallelFor)
+	{
+		for (const FKernel& Kernel : GetAvailableKernelList())
+		{
+			if (strcmp(Kernel.Name, KernelName) == 0) {
+				return ConvertWithKernel(Kernel.Function, Src, SrcPitch, Width, Height, Dst, DstPitch, DstFormat, ColorSpace, bFullRange, NumSlices, ParallelFor);
+			}
+		}
+
+		return false;
+	}
+
+	bool ConvertBGRAWithSwscale(SwsContext*& ScaleCtx, const uint8_t* Src, int32_t SrcPitch, int32_t Width, int32_t Height,
+		uint8_t* const Dst[], const int32_t DstPitch[], enum AVPixelFormat DstFormat, AVColorSpace ColorSpace, bool bFullRange)
+	{
+		SwsContext* PreviousScaleCtx = ScaleCtx;
+
+		ScaleCtx = sws_getCachedContext(ScaleCtx, Width, Height, AV_PIX_FMT_BGRA,
+			Width, Height, DstFormat, SWS_BILINEAR, nullptr, nullptr, nullptr);
+		if (ScaleCtx == nullptr) {
+			return false;
+		}
+
+		// swscale defaults to BT.601 video range, match what the native kernels and the stream metadata use.
+		if (ScaleCtx != PreviousScaleCtx) {
+			sws_setColorspaceDetails(ScaleCtx, sws_getCoefficients(SWS_CS_DEFAULT), 1,
+				sws_getCoefficients(ColorSpace == AVCOL_SPC_BT709 ? SWS_CS_ITU709 : SWS_CS_ITU601), bFullRange ? 1 : 0,
+				0, 1 << 16, 1 << 16);
+		}
+
+		const uint8_t* SrcData[4] = { Src, nullptr, nullptr, nullptr };
+		const int32_t SrcLinesize[4] = { SrcPitch, 0, 0, 0 };
+
+		return sws_scale(ScaleCtx, SrcData, SrcLinesize, 0, Height, Dst, DstPitch) == Height;
+	}
+
+	static uint64_t HashRows(const uint8_t* Src, int32_t SrcPitch, int32_t RowBytes, int32_t FirstRow, int32_t LastRow)
+	{
+		static constexpr uint64_t Prime = 0x9E3779B97F4A7C15ull;
+
+		// Four independent lanes so the multiplies overlap.
+		uint64_t Lanes[4] = { 1, 2, 3, 4 };
+
+		for (int32_t Row = FirstRow; Row < LastRow; Row++)
+		{
+			const uint8_t* Bytes = Src + Row * SrcPitch;
+
+			int32_t Offset = 0;
+			for (; Offset + 32 <= RowBytes; Offset += 32)
+			{
+				for (int32_t Lane = 0; Lane < 4; Lane++)
+				{
+					uint64_t Word;
+					memcpy(&Word, Bytes + Offset + Lane * 8, 8);
+					Lanes[Lane] = (Lanes[Lane] ^ Word) * Prime;
+					Lanes[Lane] ^= Lanes[Lane] >> 29;
+				}
+			}
+
+			// BGRA rows are a multiple of 4 bytes.
+			for (; Offset + 4 <= RowBytes; Offset += 4)
+			{
+				uint32_t Pixel;
+				memcpy(&Pixel, Bytes + Offset, 4);
+				Lanes[0] = (Lanes[0] ^ Pixel) * Prime;
+			}
+		}
+
+		return ((Lanes[0] * Prime ^ Lanes[1]) * Prime ^ Lanes[2]) * Prime ^ Lanes[3];
+	}
+
+	uint64_t HashBGRA(const uint8_t* Src, int32_t SrcPitch, int32_t Width, int32_t Height, int32_t NumSlices, const FCaptureParallelFor& ParallelFor)
+	{
+		NumSlices = std::min(std::max(NumSlices, 1), std::min(std::max(Height / (MinRowPairsPerSlice * 2), 1), MaxSlices));
+
+		uint64_t SliceHashes[MaxSlices] = { 0 };
+
+		ForEachSlice(NumSlices, ParallelFor, [&](int32_t Slice)
+		{
+			SliceHashes[Slice] = HashRows(Src, SrcPitch, Width * 4, Height * Slice / NumSlices, Height * (Slice + 1) / NumSlices);
+		});
+
+		uint64_t Hash = uint64_t(NumSlices);
+		for (int32_t Slice = 0; Slice < NumSlices; Slice++)
+		{
+			Hash = (Hash ^ SliceHashes[Slice]) * 0x9E3779B97F4A7C15ull;
+		}
+
+		return Hash;
+	}
+
+	const char* GetKernelName()
+	{
+		return GetKernel().Name;
+	}
+
+	std::vector<const char*> GetAvailableKernels()
+	{
+		std::vector<const char*> Names;
+		for (const FKernel& Kernel : GetAvailableKernelList())
+		{
+			Names.push_back(Kernel.Name);
+		}
+
+		return Names;
+	}
+}
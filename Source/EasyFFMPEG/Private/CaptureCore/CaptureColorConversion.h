@@ -0,0 +1,52 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CaptureCoreTypes.h"
+
+struct SwsContext;
+
+/**
+ * Native BGRA -> YUV 4:2:0 conversion for the capture path, where source and destination always have the same size.
+ * The kernel is picked once at runtime from the CPU features (AVX2, SSE2 or plain C++), formats without a kernel
+ * are left to swscale by the caller.
+ */
+namespace CaptureColorConversion
+{
+	/** Returns true if there is a native kernel converting BGRA into DstFormat. */
+	bool IsFormatSupported(enum AVPixelFormat DstFormat);
+
+	/**
+	 * Converts a BGRA frame into planar I420 (AV_PIX_FMT_YUV420P) or semi-planar NV12 with the BT.709 matrix for
+	 * AVCOL_SPC_BT709 and BT.601 otherwise. The frame is cut into up to NumSlices horizontal bands converted on ParallelFor.
+	 * Returns false without touching Dst if DstFormat is not supported.
+	 */
+	bool ConvertBGRAToYUV(const uint8_t* Src, int32_t SrcPitch, int32_t Width, int32_t Height,
+		uint8_t* const Dst[], const int32_t DstPitch[], enum AVPixelFormat DstFormat, AVColorSpace ColorSpace, bool bFullRange,
+		int32_t NumSlices = 1, const FCaptureParallelFor& ParallelFor = FCaptureParallelFor());
+
+	/** ConvertBGRAToYUV() with one of GetAvailableKernels() instead of the fastest, for benchmarks. False for unknown kernels. */
+	bool ConvertBGRAToYUVWithKernel(const char* KernelName, const uint8_t* Src, int32_t SrcPitch, int32_t Width, int32_t Height,
+		uint8_t* const Dst[], const int32_t DstPitch[], enum AVPixelFormat DstFormat, AVColorSpace ColorSpace, bool bFullRange,
+		int32_t NumSlices = 1, const FCaptureParallelFor& ParallelFor = FCaptureParallelFor());
+
+	/**
+	 * swscale fallback for formats without a native kernel. ScaleCtx is created on first use and only rebuilt when
+	 * the size or format changes, the caller frees it with sws_freeContext().
+	 */
+	bool ConvertBGRAWithSwscale(SwsContext*& ScaleCtx, const uint8_t* Src, int32_t SrcPitch, int32_t Width, int32_t Height,
+		uint8_t* const Dst[], const int32_t DstPitch[], enum AVPixelFormat DstFormat, AVColorSpace ColorSpace, bool bFullRange);
+
+	/**
+	 * 64 bit hash of the visible pixels of a BGRA frame (row padding is ignored), to spot frames identical to the
+	 * previous one. Split into up to NumSlices bands like the conversion.
+	 */
+	uint64_t HashBGRA(const uint8_t* Src, int32_t SrcPitch, int32_t Width, int32_t Height,
+		int32_t NumSlices = 1, const FCaptureParallelFor& ParallelFor = FCaptureParallelFor());
+
+	/** Name of the kernel picked for this CPU, for logging. */
+	const char* GetKernelName();
+
+	/** Every kernel this CPU can run, "Scalar" (the reference) first and the one GetKernelName() picked last. */
+	std::vector<const char*> GetAvailableKernels();
+}
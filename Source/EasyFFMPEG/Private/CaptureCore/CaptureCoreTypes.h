@@ -0,0 +1,91 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+// The capture core is plain C++ on top of FFmpeg: no engine headers, so it also builds standalone (see CMakeLists.txt).
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include "libavutil/pixfmt.h"
+}
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CAPTURE_CORE_X86 1
+#else
+#define CAPTURE_CORE_X86 0
+#endif
+
+/**
+ * Runs Body(0) .. Body(NumTasks - 1), possibly in parallel, and returns once all of them are done.
+ * The engine passes its task graph in, an empty function runs them one after the other.
+ */
+typedef std::function<void(int32_t NumTasks, const std::function<void(int32_t Task)>& Body)> FCaptureParallelFor;
+
+enum class ECaptureCoreRateControl : uint8_t
+{
+	/** Average bitrate, targets BitRate. */
+	ABR,
+	/** Constant quality, targets CRF. */
+	CRF,
+	/** Constant quantizer, every frame is encoded with QP. */
+	CQP,
+};
+
+/** Everything FCaptureVideoEncoder needs to open the codec, in FFmpeg's own units. */
+struct FCaptureVideoSettings
+{
+	int32_t Width = 0;
+	int32_t Height = 0;
+
+	/** Nominal frame rate as Num / Den frames per second. */
+	int32_t FrameRateNum = 30;
+	int32_t FrameRateDen = 1;
+
+	/** Variable frame rate captures stamp frames in 1 / VariableFrameRateClock units, 0 uses the frame index. */
+	int32_t VariableFrameRateClock = 0;
+
+	int32_t GopSize = 10;
+	int32_t MaxBFrames = 1;
+
+	/** AV_PIX_FMT_YUV420P and AV_PIX_FMT_NV12 have native converters, anything else goes through swscale. */
+	AVPixelFormat PixelFormat = AV_PIX_FMT_YUV420P;
+
+	/** AVCOL_SPC_BT709, anything else converts with BT.601. */
+	AVColorSpace ColorSpace = AVCOL_SPC_BT709;
+	bool bFullRange = false;
+
+	/** Horizontal bands each conversion and hash is split into. */
+	int32_t ConversionSlices = 1;
+
+	/** Skip converting frames identical to the previous one, see FCaptureVideoEncoder::EncodeBGRA(). */
+	bool bElideStaticFrames = false;
+
+	/** x264 / x265 only, empty leaves the codec default. */
+	std::string Preset;
+	std::string Tune;
+
+	ECaptureCoreRateControl RateControl = ECaptureCoreRateControl::ABR;
+
+	/** bit/s */
+	int64_t BitRate = 5000000;
+	float CRF = 23.f;
+	int32_t QP = 23;
+
+	/** VBV limits in bit/s and bit, 0 leaves the bitrate unconstrained / uses MaxBitRate. */
+	int64_t MaxBitRate = 0;
+	int64_t BufferSize = 0;
+
+	/** 0 lets the codec pick. */
+	int32_t Threads = 0;
+
+	/** FF_THREAD_FRAME or FF_THREAD_SLICE, 0 lets the codec pick. */
+	int32_t ThreadType = 0;
+
+	/** Passed to avcodec_open2 last, so they override the settings above. */
+	std::vector<std::pair<std::string, std::string>> CodecOptions;
+};
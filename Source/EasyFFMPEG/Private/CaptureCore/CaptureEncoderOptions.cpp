@@ -0,0 +1,98 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "CaptureEncoderOptions.h"
+
+#include <cstdio>
+#include <cstring>
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+#include "libavformat/avformat.h"
+#include "libavutil/dict.h"
+#include "libavutil/log.h"
+}
+
+namespace CaptureEncoderOptions
+{
+	void Apply(AVCodecContext* CodecCtx, const FCaptureVideoSettings& Settings, AVDictionary** Options)
+	{
+		const bool bIsX26X = CodecCtx->codec_id == AV_CODEC_ID_H264 || CodecCtx->codec_id == AV_CODEC_ID_HEVC;
+
+		if (bIsX26X) {
+			if (!Settings.Preset.empty()) {
+				av_dict_set(Options, "preset", Settings.Preset.c_str(), 0);
+			}
+
+			if (!Settings.Tune.empty()) {
+				av_dict_set(Options, "tune", Settings.Tune.c_str(), 0);
+			}
+		}
+
+		switch (Settings.RateControl)
+		{
+		case ECaptureCoreRateControl::ABR:
+			CodecCtx->bit_rate = Settings.BitRate;
+			break;
+		case ECaptureCoreRateControl::CRF:
+		{
+			char CRF[32];
+			snprintf(CRF, sizeof(CRF), "%g", Settings.CRF);
+
+			CodecCtx->bit_rate = 0;
+			av_dict_set(Options, "crf", CRF, 0);
+			break;
+		}
+		case ECaptureCoreRateControl::CQP:
+			CodecCtx->bit_rate = 0;
+			av_dict_set_int(Options, "qp", Settings.QP, 0);
+			break;
+		}
+
+		if (Settings.MaxBitRate > 0 && Settings.RateControl != ECaptureCoreRateControl::CQP) {
+			CodecCtx->rc_max_rate = Settings.MaxBitRate;
+			CodecCtx->rc_buffer_size = int(Settings.BufferSize > 0 ? Settings.BufferSize : Settings.MaxBitRate);
+		}
+
+		CodecCtx->thread_count = Settings.Threads;
+
+		if (Settings.ThreadType != 0) {
+			CodecCtx->thread_type = Settings.ThreadType;
+		}
+
+		for (const std::pair<std::string, std::string>& Option : Settings.CodecOptions)
+		{
+			av_dict_set(Options, Option.first.c_str(), Option.second.c_str(), 0);
+		}
+	}
+
+	void ApplyMuxer(const AVOutputFormat* OutputFormat, bool bFragmented, double FragmentDuration, AVDictionary** Options)
+	{
+		if (!bFragmented) {
+			return;
+		}
+
+		// "mov,mp4,m4a,..." style lists only exist for demuxers, the muxers are plainly named.
+		const char* FormatName = OutputFormat->name;
+		if (strcmp(FormatName, "mp4") != 0 && strcmp(FormatName, "mov") != 0 && strcmp(FormatName, "ipod") != 0) {
+			av_log(nullptr, AV_LOG_WARNING, "Fragmented output needs an MP4 or MOV container, writing a regular %s file.\n", FormatName);
+			return;
+		}
+
+		// empty_moov puts an initial moov up front, frag_keyframe starts every fragment on a keyframe once
+		// min_frag_duration has passed.
+		av_dict_set(Options, "movflags", "frag_keyframe+empty_moov+default_base_moof", 0);
+		av_dict_set_int(Options, "min_frag_duration", int64_t(FragmentDuration * AV_TIME_BASE), 0);
+	}
+
+	void ReportUnusedAndFree(AVDictionary** Options)
+	{
+		const AVDictionaryEntry* Entry = nullptr;
+		while ((Entry = av_dict_get(*Options, "", Entry, AV_DICT_IGNORE_SUFFIX)) != nullptr)
+		{
+			av_log(nullptr, AV_LOG_WARNING, "Option %s=%s was not recognised.\n", Entry->key, Entry->value);
+		}
+
+		av_dict_free(Options);
+	}
+}
@@ -0,0 +1,25 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CaptureCoreTypes.h"
+
+struct AVCodecContext;
+struct AVDictionary;
+struct AVOutputFormat;
+
+/**
+ * Translates the encoder and muxer settings into codec context fields and the option dictionaries handed to
+ * avcodec_open2 / avformat_write_header.
+ */
+namespace CaptureEncoderOptions
+{
+	/** Sets rate control and threading on CodecCtx and fills Options with preset, tune and the extra codec options. */
+	void Apply(AVCodecContext* CodecCtx, const FCaptureVideoSettings& Settings, AVDictionary** Options);
+
+	/** Fills Options with the muxer settings for OutputFormat: fragmented MP4 with fragments of at least FragmentDuration seconds. */
+	void ApplyMuxer(const AVOutputFormat* OutputFormat, bool bFragmented, double FragmentDuration, AVDictionary** Options);
+
+	/** Warns about every entry avcodec_open2 / avformat_write_header left in Options (i.e. it was not recognised) and frees it. */
+	void ReportUnusedAndFree(AVDictionary** Options);
+}
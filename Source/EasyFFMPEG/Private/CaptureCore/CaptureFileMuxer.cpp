@@ -0,0 +1,132 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "CaptureFileMuxer.h"
+#include "CaptureEncoderOptions.h"
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+#include "libavformat/avformat.h"
+#include "libavutil/log.h"
+}
+
+FCaptureFileMuxer::FCaptureFileMuxer()
+	: FormatCtx(nullptr)
+	, bOwnsIOContext(false)
+	, bStarted(false)
+	, bFailed(false)
+{
+}
+
+FCaptureFileMuxer::~FCaptureFileMuxer()
+{
+	Finish();
+}
+
+bool FCaptureFileMuxer::Create(const std::string& InFilename)
+{
+	Finish();
+
+	Filename = InFilename;
+	bFailed = false;
+
+	if (avformat_alloc_output_context2(&FormatCtx, nullptr, nullptr, Filename.c_str()) < 0) {
+		av_log(nullptr, AV_LOG_ERROR, "Can not allocate the output context of '%s'.\n", Filename.c_str());
+		FormatCtx = nullptr;
+		return false;
+	}
+
+	return true;
+}
+
+int32_t FCaptureFileMuxer::AddStream(const AVCodecContext* CodecCtx)
+{
+	AVStream* Stream = avformat_new_stream(FormatCtx, nullptr);
+	if (Stream == nullptr || avcodec_parameters_from_context(Stream->codecpar, CodecCtx) < 0) {
+		av_log(FormatCtx, AV_LOG_ERROR, "Can not allocate a new stream.\n");
+		return -1;
+	}
+
+	// Only a hint, the header may still change it.
+	Stream->time_base = CodecCtx->time_base;
+
+	return Stream->index;
+}
+
+bool FCaptureFileMuxer::Start(AVIOContext* IOContext, AVDictionary** Options)
+{
+	if (IOContext != nullptr) {
+		FormatCtx->pb = IOContext;
+		FormatCtx->flags |= AVFMT_FLAG_CUSTOM_IO;
+	}
+	else if ((FormatCtx->oformat->flags & AVFMT_NOFILE) == 0) {
+		if (avio_open(&FormatCtx->pb, Filename.c_str(), AVIO_FLAG_WRITE) < 0) {
+			av_log(FormatCtx, AV_LOG_ERROR, "Can not open '%s' for writing.\n", Filename.c_str());
+			return false;
+		}
+
+		bOwnsIOContext = true;
+	}
+
+	av_dump_format(FormatCtx, 0, Filename.c_str(), 1);
+
+	const int32_t Result = avformat_write_header(FormatCtx, Options);
+	if (Options != nullptr) {
+		CaptureEncoderOptions::ReportUnusedAndFree(Options);
+	}
+
+	if (Result < 0) {
+		av_log(FormatCtx, AV_LOG_ERROR, "Error ocurred when write header into file.\n");
+		return false;
+	}
+
+	bStarted = true;
+
+	return true;
+}
+
+bool FCaptureFileMuxer::WritePacket(AVPacket* InPacket, int32_t StreamIndex, AVRational SourceTimeBase)
+{
+	av_packet_rescale_ts(InPacket, SourceTimeBase, FormatCtx->streams[StreamIndex]->time_base);
+
+	InPacket->stream_index = StreamIndex;
+
+	// Takes over the reference even when it fails.
+	if (av_interleaved_write_frame(FormatCtx, InPacket) < 0) {
+		av_log(FormatCtx, AV_LOG_ERROR, "Error during interleaved write frame.\n");
+		bFailed = true;
+		return false;
+	}
+
+	return true;
+}
+
+bool FCaptureFileMuxer::Finish()
+{
+	if (FormatCtx == nullptr) {
+		return !bFailed;
+	}
+
+	if (bStarted && av_write_trailer(FormatCtx) < 0) {
+		bFailed = true;
+	}
+
+	if (bOwnsIOContext) {
+		avio_closep(&FormatCtx->pb);
+	}
+
+	// A caller's IO context stays theirs.
+	FormatCtx->pb = nullptr;
+	avformat_free_context(FormatCtx);
+	FormatCtx = nullptr;
+
+	bOwnsIOContext = false;
+	bStarted = false;
+
+	return !bFailed;
+}
+
+const AVOutputFormat* FCaptureFileMuxer::GetOutputFormat() const
+{
+	return FormatCtx != nullptr ? FormatCtx->oformat : nullptr;
+}
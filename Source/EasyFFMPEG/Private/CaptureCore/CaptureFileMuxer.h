@@ -0,0 +1,59 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CaptureCoreTypes.h"
+
+extern "C" {
+#include "libavutil/rational.h"
+}
+
+struct AVCodecContext;
+struct AVDictionary;
+struct AVFormatContext;
+struct AVIOContext;
+struct AVOutputFormat;
+struct AVPacket;
+
+/** The mux end of the core: one output file, its container picked from the filename. Single threaded. */
+class FCaptureFileMuxer
+{
+public:
+	FCaptureFileMuxer();
+
+	~FCaptureFileMuxer();
+
+	/** Allocates the output context for Filename, nothing is written yet. */
+	bool Create(const std::string& InFilename);
+
+	/** Adds a stream for an opened encoder and returns its index, -1 on failure. */
+	int32_t AddStream(const AVCodecContext* CodecCtx);
+
+	/**
+	 * Writes the header. With IOContext the output goes there (the caller keeps ownership and must keep it alive until
+	 * Finish()), otherwise the file is opened with avio. Entries of Options the muxer did not use are reported and freed.
+	 */
+	bool Start(AVIOContext* IOContext, AVDictionary** Options);
+
+	/** Takes over the packet's reference (InPacket is left blank), timestamps in SourceTimeBase. */
+	bool WritePacket(AVPacket* InPacket, int32_t StreamIndex, AVRational SourceTimeBase);
+
+	/** Writes the trailer if the header was written and closes the output. Returns false if any write failed. */
+	bool Finish();
+
+	bool IsStarted() const { return bStarted; }
+
+	const AVOutputFormat* GetOutputFormat() const;
+
+	AVFormatContext* GetFormatContext() const { return FormatCtx; }
+
+private:
+	std::string Filename;
+
+	AVFormatContext* FormatCtx;
+
+	/** Set when Start() opened the file itself rather than writing into a caller's IO context. */
+	bool bOwnsIOContext;
+	bool bStarted;
+	bool bFailed;
+};
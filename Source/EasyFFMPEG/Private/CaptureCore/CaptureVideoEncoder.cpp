@@ -0,0 +1,237 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "CaptureVideoEncoder.h"
+#include "CaptureColorConversion.h"
+#include "CaptureEncoderOptions.h"
+
+#include <chrono>
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+#include "libavformat/avformat.h"
+#include "libavutil/error.h"
+#include "libavutil/log.h"
+#include "libswscale/swscale.h"
+}
+
+typedef std::chrono::steady_clock FTimingClock;
+
+static double SecondsSince(FTimingClock::time_point Start)
+{
+	return std::chrono::duration<double>(FTimingClock::now() - Start).count();
+}
+
+FCaptureVideoEncoder::FCaptureVideoEncoder()
+	: CodecCtx(nullptr)
+	, Frame(nullptr)
+	, Packet(nullptr)
+	, ScaleCtx(nullptr)
+	, LastFrameHash(0)
+	, bHasLastFrameHash(false)
+	, LastElidedPts(-1)
+	, ElidedFrameCount(0)
+{
+}
+
+FCaptureVideoEncoder::~FCaptureVideoEncoder()
+{
+	Close();
+}
+
+bool FCaptureVideoEncoder::Open(const AVOutputFormat* OutputFormat, const FCaptureVideoSettings& InSettings, FPacketCallback InOnPacket, FCaptureParallelFor InParallelFor)
+{
+	Close();
+
+	Settings = InSettings;
+	OnPacket = std::move(InOnPacket);
+	ParallelFor = std::move(InParallelFor);
+
+	const AVCodec* Codec = avcodec_find_encoder(OutputFormat->video_codec);
+	if (Codec == nullptr) {
+		av_log(nullptr, AV_LOG_ERROR, "No encoder for the video codec of %s.\n", OutputFormat->name);
+		return false;
+	}
+
+	CodecCtx = avcodec_alloc_context3(Codec);
+	if (CodecCtx == nullptr) {
+		av_log(nullptr, AV_LOG_ERROR, "Could not allocate the video codec context.\n");
+		return false;
+	}
+
+	CodecCtx->width = Settings.Width;
+	CodecCtx->height = Settings.Height;
+	CodecCtx->pix_fmt = Settings.PixelFormat;
+
+	// Rate control still works from the nominal frame rate below.
+	CodecCtx->time_base = Settings.VariableFrameRateClock > 0 ? AVRational{ 1, Settings.VariableFrameRateClock } : AVRational{ Settings.FrameRateDen, Settings.FrameRateNum };
+	CodecCtx->framerate = { Settings.FrameRateNum, Settings.FrameRateDen };
+	CodecCtx->gop_size = Settings.GopSize;
+	CodecCtx->max_b_frames = Settings.MaxBFrames;
+	CodecCtx->colorspace = Settings.ColorSpace;
+	CodecCtx->color_range = Settings.bFullRange ? AVCOL_RANGE_JPEG : AVCOL_RANGE_MPEG;
+
+	AVDictionary* CodecOptions = nullptr;
+	CaptureEncoderOptions::Apply(CodecCtx, Settings, &CodecOptions);
+
+	const int32_t Result = avcodec_open2(CodecCtx, Codec, &CodecOptions);
+	CaptureEncoderOptions::ReportUnusedAndFree(&CodecOptions);
+	if (Result < 0) {
+		av_log(nullptr, AV_LOG_ERROR, "Could not open the %s encoder.\n", Codec->name);
+		Close();
+		return false;
+	}
+
+	Packet = av_packet_alloc();
+	Frame = av_frame_alloc();
+	if (Packet == nullptr || Frame == nullptr) {
+		av_log(nullptr, AV_LOG_ERROR, "Could not allocate the video frame.\n");
+		Close();
+		return false;
+	}
+
+	Frame->format = CodecCtx->pix_fmt;
+	Frame->width = CodecCtx->width;
+	Frame->height = CodecCtx->height;
+
+	if (av_frame_get_buffer(Frame, 0) < 0) {
+		av_log(nullptr, AV_LOG_ERROR, "Could not allocate the video frame data.\n");
+		Close();
+		return false;
+	}
+
+	bHasLastFrameHash = false;
+	LastElidedPts = -1;
+	ElidedFrameCount = 0;
+
+	return true;
+}
+
+bool FCaptureVideoEncoder::EncodeBGRA(const uint8_t* Src, int32_t SrcPitch, int64_t Pts)
+{
+	const int32_t Width = CodecCtx->width;
+	const int32_t Height = CodecCtx->height;
+
+	LastFrameTiming = FCaptureFrameTiming();
+
+	uint64_t FrameHash = 0;
+	if (Settings.bElideStaticFrames) {
+		const FTimingClock::time_point HashStart = FTimingClock::now();
+		FrameHash = CaptureColorConversion::HashBGRA(Src, SrcPitch, Width, Height, Settings.ConversionSlices, ParallelFor);
+		LastFrameTiming.Hash = SecondsSince(HashStart);
+
+		if (bHasLastFrameHash && FrameHash == LastFrameHash) {
+			ElidedFrameCount.fetch_add(1, std::memory_order_relaxed);
+
+			// The last encoded frame simply lasts until the next one that differs.
+			if (Settings.VariableFrameRateClock > 0) {
+				LastElidedPts = Pts;
+				return true;
+			}
+
+			// Frame still holds the previous picture, the encoder turns it into skip blocks.
+			Frame->pts = Pts;
+			return SendFrame(Frame);
+		}
+	}
+
+	const FTimingClock::time_point ConvertStart = FTimingClock::now();
+
+	const bool bConverted =
+		CaptureColorConversion::ConvertBGRAToYUV(Src, SrcPitch, Width, Height, Frame->data, Frame->linesize, CodecCtx->pix_fmt, Settings.ColorSpace, Settings.bFullRange, Settings.ConversionSlices, ParallelFor) ||
+		CaptureColorConversion::ConvertBGRAWithSwscale(ScaleCtx, Src, SrcPitch, Width, Height, Frame->data, Frame->linesize, CodecCtx->pix_fmt, Settings.ColorSpace, Settings.bFullRange);
+
+	LastFrameTiming.Convert = SecondsSince(ConvertStart);
+
+	if (!bConverted) {
+		bHasLastFrameHash = false;
+		return false;
+	}
+
+	LastFrameHash = FrameHash;
+	bHasLastFrameHash = Settings.bElideStaticFrames;
+	LastElidedPts = -1;
+
+	Frame->pts = Pts;
+
+	return SendFrame(Frame);
+}
+
+void FCaptureVideoEncoder::Flush()
+{
+	if (CodecCtx == nullptr) {
+		return;
+	}
+
+	LastFrameTiming = FCaptureFrameTiming();
+
+	if (LastElidedPts >= 0) {
+		Frame->pts = LastElidedPts;
+		SendFrame(Frame);
+		LastElidedPts = -1;
+	}
+
+	SendFrame(nullptr);
+}
+
+void FCaptureVideoEncoder::Close()
+{
+	if (CodecCtx != nullptr) {
+		avcodec_free_context(&CodecCtx);
+	}
+
+	if (Frame != nullptr) {
+		av_frame_free(&Frame);
+	}
+
+	if (Packet != nullptr) {
+		av_packet_free(&Packet);
+	}
+
+	if (ScaleCtx != nullptr) {
+		sws_freeContext(ScaleCtx);
+		ScaleCtx = nullptr;
+	}
+}
+
+const char* FCaptureVideoEncoder::GetConversionName() const
+{
+	return CaptureColorConversion::IsFormatSupported(Settings.PixelFormat) ? CaptureColorConversion::GetKernelName() : "swscale";
+}
+
+bool FCaptureVideoEncoder::SendFrame(AVFrame* InFrame)
+{
+	const FTimingClock::time_point EncodeStart = FTimingClock::now();
+	double PacketSeconds = 0.0;
+
+	int32_t Result = avcodec_send_frame(CodecCtx, InFrame);
+	if (Result < 0) {
+		av_log(CodecCtx, AV_LOG_ERROR, "Error sending a frame for encoding.\n");
+		return false;
+	}
+
+	while (true)
+	{
+		Result = avcodec_receive_packet(CodecCtx, Packet);
+		if (Result == AVERROR(EAGAIN) || Result == AVERROR_EOF) {
+			break;
+		}
+		else if (Result < 0) {
+			av_log(CodecCtx, AV_LOG_ERROR, "Error during encoding.\n");
+			return false;
+		}
+
+		if (OnPacket) {
+			const FTimingClock::time_point PacketStart = FTimingClock::now();
+			OnPacket(Packet);
+			PacketSeconds += SecondsSince(PacketStart);
+		}
+
+		av_packet_unref(Packet);
+	}
+
+	LastFrameTiming.Packets += PacketSeconds;
+	LastFrameTiming.Encode += SecondsSince(EncodeStart) - PacketSeconds;
+
+	return true;
+}
@@ -0,0 +1,96 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CaptureCoreTypes.h"
+#include <atomic>
+
+struct AVCodecContext;
+struct AVFrame;
+struct AVOutputFormat;
+struct AVPacket;
+struct SwsContext;
+
+/** Where the last FCaptureVideoEncoder::EncodeBGRA() spent its time, in seconds. */
+struct FCaptureFrameTiming
+{
+	double Hash = 0.0;
+	double Convert = 0.0;
+
+	/** avcodec_send_frame / avcodec_receive_packet, without the packet callback. */
+	double Encode = 0.0;
+
+	/** Inside the packet callback, i.e. muxing. */
+	double Packets = 0.0;
+};
+
+/**
+ * Frame in, packets out: converts captured BGRA frames into the codec's pixel format and encodes them. Not thread
+ * safe, every call after Open() must come from the same thread (or be serialized by the caller).
+ */
+class FCaptureVideoEncoder
+{
+public:
+	/** Receives every encoded packet, timestamps in the codec time base. Whatever is left in the packet afterwards is unreferenced. */
+	typedef std::function<void(AVPacket* Packet)> FPacketCallback;
+
+	FCaptureVideoEncoder();
+
+	~FCaptureVideoEncoder();
+
+	/** Opens the default video encoder of OutputFormat. ParallelFor runs the conversion bands, empty converts on the calling thread. */
+	bool Open(const AVOutputFormat* OutputFormat, const FCaptureVideoSettings& InSettings, FPacketCallback InOnPacket, FCaptureParallelFor InParallelFor = FCaptureParallelFor());
+
+	/**
+	 * Converts one BGRA frame and encodes it at Pts (codec time base). With bElideStaticFrames a frame identical to the
+	 * previous one is not converted: variable frame rate captures skip it so the previous frame simply lasts longer,
+	 * constant frame rate ones encode the previous picture again, which costs next to nothing.
+	 */
+	bool EncodeBGRA(const uint8_t* Src, int32_t SrcPitch, int64_t Pts);
+
+	/** Drains every frame still in the encoder. A variable frame rate capture ends at its last frame, even if it was elided. */
+	void Flush();
+
+	/** Frees the codec, safe to call more than once. */
+	void Close();
+
+	bool IsOpen() const { return CodecCtx != nullptr; }
+
+	/** Valid between Open() and Close(). */
+	AVCodecContext* GetCodecContext() const { return CodecCtx; }
+
+	const FCaptureVideoSettings& GetSettings() const { return Settings; }
+
+	/** The native kernel the frames are converted with, or "swscale". */
+	const char* GetConversionName() const;
+
+	/** Timing of the last EncodeBGRA() or Flush(), same thread only. */
+	const FCaptureFrameTiming& GetLastFrameTiming() const { return LastFrameTiming; }
+
+	/** Frames found identical to the previous one since Open(), any thread. */
+	int32_t GetElidedFrameCount() const { return ElidedFrameCount.load(std::memory_order_relaxed); }
+
+private:
+	/** Sends InFrame (nullptr drains) and hands every packet the codec returns to OnPacket. */
+	bool SendFrame(AVFrame* InFrame);
+
+	FCaptureVideoSettings Settings;
+	FPacketCallback OnPacket;
+	FCaptureParallelFor ParallelFor;
+
+	AVCodecContext* CodecCtx;
+	AVFrame* Frame;
+	AVPacket* Packet;
+	SwsContext* ScaleCtx;
+
+	/** Hash of the last frame converted into Frame. */
+	uint64_t LastFrameHash;
+	bool bHasLastFrameHash;
+
+	/** Pts of the newest elided frame of a variable frame rate capture, -1 once a frame is encoded after it. */
+	int64_t LastElidedPts;
+
+	std::atomic<int32_t> ElidedFrameCount;
+
+	FCaptureFrameTiming LastFrameTiming;
+};
@@ -0,0 +1,79 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "VideoCaptureAudioEncoderThread.h"
+
+#include "HAL/RunnableThread.h"
+
+FVideoCaptureAudioEncoderThread::FVideoCaptureAudioEncoderThread(FEncodePendingAudioFunction InEncodePendingAudio)
+	: EncodePendingAudio(MoveTemp(InEncodePendingAudio))
+	, bStopping(false)
+	, WorkEvent(nullptr)
+	, Thread(nullptr)
+{
+}
+
+FVideoCaptureAudioEncoderThread::~FVideoCaptureAudioEncoderThread()
+{
+	StopAndFlush();
+}
+
+bool FVideoCaptureAudioEncoderThread::Start()
+{
+	check(Thread == nullptr);
+
+	bStopping = false;
+	WorkEvent = FPlatformProcess::GetSynchEventFromPool(false);
+	Thread = FRunnableThread::Create(this, TEXT("VideoCaptureAudioEncoder"), 0, TPri_AboveNormal);
+
+	return Thread != nullptr;
+}
+
+void FVideoCaptureAudioEncoderThread::StopAndFlush()
+{
+	if (Thread != nullptr) {
+		Stop();
+		Thread->WaitForCompletion();
+
+		delete Thread;
+		Thread = nullptr;
+	}
+
+	if (WorkEvent != nullptr) {
+		FPlatformProcess::ReturnSynchEventToPool(WorkEvent);
+		WorkEvent = nullptr;
+	}
+}
+
+void FVideoCaptureAudioEncoderThread::Notify()
+{
+	if (WorkEvent != nullptr) {
+		WorkEvent->Trigger();
+	}
+}
+
+uint32 FVideoCaptureAudioEncoderThread::Run()
+{
+	while (true)
+	{
+		EncodePendingAudio();
+
+		// Checked after encoding, so the samples written before Stop() still make it into the file.
+		if (bStopping) {
+			break;
+		}
+
+		WorkEvent->Wait();
+	}
+
+	return 0;
+}
+
+void FVideoCaptureAudioEncoderThread::Stop()
+{
+	bStopping = true;
+
+	if (WorkEvent != nullptr) {
+		WorkEvent->Trigger();
+	}
+}
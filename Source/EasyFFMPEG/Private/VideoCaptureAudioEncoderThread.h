@@ -0,0 +1,41 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/Runnable.h"
+#include "HAL/ThreadSafeBool.h"
+
+/**
+ * Worker thread that resamples and encodes the submix audio, so the audio mixer callback only has to copy samples
+ * into a lock free buffer and wake it up.
+ */
+class FVideoCaptureAudioEncoderThread : public FRunnable
+{
+public:
+	typedef TFunction<void()> FEncodePendingAudioFunction;
+
+	explicit FVideoCaptureAudioEncoderThread(FEncodePendingAudioFunction InEncodePendingAudio);
+
+	virtual ~FVideoCaptureAudioEncoderThread();
+
+	bool Start();
+
+	/** Encodes what is still buffered and joins the thread. */
+	void StopAndFlush();
+
+	/** Any thread, never blocks. Wakes the thread up after new samples were written. */
+	void Notify();
+
+	//~ Begin FRunnable interface
+	virtual uint32 Run() override;
+	virtual void Stop() override;
+	//~ End FRunnable interface
+
+private:
+	FEncodePendingAudioFunction EncodePendingAudio;
+
+	FThreadSafeBool bStopping;
+	FEvent* WorkEvent;
+	FRunnableThread* Thread;
+};
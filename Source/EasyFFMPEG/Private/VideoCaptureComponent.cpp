@@ -2,20 +2,22 @@
 
 
 #include "VideoCaptureComponent.h"
+#include "VideoColorConversion.h"
+#include "VideoEncoderOptions.h"
+#include "VideoCaptureFileWriter.h"
+#include "CaptureCore/CaptureVideoEncoder.h"
+#include "CaptureCore/CaptureFileMuxer.h"
+#include "VideoCaptureStats.h"
 
 #include "EasyFFMPEG.h"
 #include "Engine/GameEngine.h"
-#include "HAL/FileManager.h"
 
 #include "Kismet/GameplayStatics.h"
+#include "Misc/App.h"
+#include "RenderingThread.h"
 
 extern "C" {
 #include "libavcodec/avcodec.h"
-#include "libavutil/opt.h"
-#include "libavformat/avformat.h"
-#include "libavutil/imgutils.h"
-#include "libswscale/swscale.h"
-#include "libavutil/error.h"
 }
 
 #if WITH_EDITOR
@@ -24,9 +26,23 @@ extern "C" {
 #include "IAssetViewport.h"
 #endif
 
+/** Rides along with every frame asked from the grabber, so the encode latency includes the readback. */
+struct FCaptureTimePayload : public IFramePayload
+{
+	uint64 CaptureCycles = FPlatformTime::Cycles64();
+};
+
+static uint64 GetCaptureCycles(const FCapturedFrameData& Frame)
+{
+	return Frame.Payload.IsValid() ? static_cast<const FCaptureTimePayload*>(Frame.Payload.Get())->CaptureCycles : FPlatformTime::Cycles64();
+}
+
 // Sets default values for this component's properties
 UVideoCaptureComponent::UVideoCaptureComponent()
 	: CaptureState(EMovieCaptureState::NotInit)
+	, bFixedTimestepApplied(false)
+	, bSavedUseFixedTimeStep(false)
+	, SavedFixedDeltaTime(0.0)
 {
 	// Set this component to be initialized when the game starts, and to be ticked every frame.  You can turn these features
 	// off to improve performance if you don't need them.
@@ -37,8 +53,16 @@ UVideoCaptureComponent::UVideoCaptureComponent()
 
 void UVideoCaptureComponent::StartCapture(const FString& InVideoFilename)
 {
+	EASYFFMPEG_SCOPE_CYCLE_COUNTER(STAT_EasyFFMPEG_StartCapture);
+
 	ShouldCutFrameCount = 0;
 	CapturedFrameNumber = 0;
+	EncodedFrameNumber = 0;
+	PendingGrabberFrames = 0;
+	DroppedFrameCount = 0;
+	ElidedFrameCount = 0;
+	StatsElapsedTime = 0.f;
+	Telemetry.Reset();
 
 	APlayerController* PC = UGameplayStatics::GetPlayerController(this, 0);
 	if (PC == nullptr) {
@@ -67,100 +91,49 @@ void UVideoCaptureComponent::StartCapture(const FString& InVideoFilename)
 		return;
 	}
 
-	DestroyVideoFileWriter();
-
-	int32 result = avformat_alloc_output_context2(&FormatCtx, nullptr, nullptr, TCHAR_TO_UTF8(*VideoFilename));
-	if (result < 0) {
+	Muxer = new FCaptureFileMuxer();
+	if (!Muxer->Create(TCHAR_TO_UTF8(*VideoFilename))) {
 		UE_LOG(LogFFmpeg, Error, TEXT("Can not allocate format context."));
 		StopCapture();
 		return;
 	}
 
-	Codec = avcodec_find_encoder(FormatCtx->oformat->video_codec);
-	if (Codec == nullptr) {
-		UE_LOG(LogFFmpeg, Error, TEXT("Codec not found."));
-		StopCapture();
-		return;
-	}
-
-	Stream = avformat_new_stream(FormatCtx, Codec);
-	if (Stream == nullptr) {
-		UE_LOG(LogFFmpeg, Error, TEXT("Can not allocate a new stream."));
-		StopCapture();
-		return;
-	}
-
-	CodecCtx = avcodec_alloc_context3(Codec);
-	if (Codec == nullptr) {
-		UE_LOG(LogFFmpeg, Error, TEXT("InitCapture() failed: Cloud not allocate video codec context."));
-		StopCapture();
-		return;
-	}
-
-	Stream->codecpar->codec_id = FormatCtx->oformat->video_codec;
-	Stream->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
-	Stream->codecpar->width = ViewportSize.X;
-	Stream->codecpar->height = ViewportSize.Y;
-	Stream->codecpar->format = AV_PIX_FMT_YUV420P;
-	Stream->codecpar->bit_rate = CaptureConfigs.BitRate * 1000;
+	// Frames are stamped with their index, see TickComponent().
+	FCaptureVideoSettings VideoSettings = VideoEncoderOptions::MakeVideoSettings(CaptureConfigs, ViewportSize);
+	VideoSettings.VariableFrameRateClock = 0;
 
-	avcodec_parameters_to_context(CodecCtx, Stream->codecpar);
-	
-	CodecCtx->time_base = { CaptureConfigs.FrameRate.Y, CaptureConfigs.FrameRate.X };
-	CodecCtx->framerate = { CaptureConfigs.FrameRate.X, CaptureConfigs.FrameRate.Y };
-	CodecCtx->gop_size = CaptureConfigs.GopSize;
-	CodecCtx->max_b_frames = CaptureConfigs.MaxBFrames;
+	UVideoCaptureComponent* This = this;
 
-	if (Stream->codecpar->codec_id == AV_CODEC_ID_H264) {
-		av_opt_set(CodecCtx, "preset", "slow", 0);
-	}
+	VideoEncoder = new FCaptureVideoEncoder();
+	const bool bEncoderOpened = VideoEncoder->Open(Muxer->GetOutputFormat(), VideoSettings,
+		[This](AVPacket* InPacket)
+		{
+			EASYFFMPEG_SCOPE_CYCLE_COUNTER(STAT_EasyFFMPEG_MuxPacket);
 
-	result = avcodec_open2(CodecCtx, Codec, nullptr);
-	if (result < 0) {
+			This->Telemetry.AddBytes(InPacket->size);
+			This->Muxer->WritePacket(InPacket, This->VideoStreamIndex, This->VideoEncoder->GetCodecContext()->time_base);
+		},
+		VideoColorConversion::GetParallelFor());
+	if (!bEncoderOpened) {
 		UE_LOG(LogFFmpeg, Error, TEXT("Could not open codec."));
 		StopCapture();
 		return;
 	}
 
-	avcodec_parameters_from_context(Stream->codecpar, CodecCtx);
-
-	av_dump_format(FormatCtx, 0, TCHAR_TO_UTF8(*VideoFilename), 1);
-
-	result = avio_open(&FormatCtx->pb, TCHAR_TO_UTF8(*VideoFilename), AVIO_FLAG_WRITE);
-	if (result < 0) {
-		UE_LOG(LogFFmpeg, Error, TEXT("Cant open the file '%s'."), *VideoFilename);
-		StopCapture();
-		return;
-	}
-
-	result = avformat_write_header(FormatCtx, nullptr);
-	if (result < 0) {
-		UE_LOG(LogFFmpeg, Error, TEXT("Error ocurred when write header into file."));
-		StopCapture();
-		return;
-	}
-
-	Packet = av_packet_alloc();
-	if (Packet == nullptr) {
-		UE_LOG(LogFFmpeg, Error, TEXT("InitCapture() failed: Cloud not allocate packet."));
+	VideoStreamIndex = Muxer->AddStream(VideoEncoder->GetCodecContext());
+	if (VideoStreamIndex == INDEX_NONE) {
+		UE_LOG(LogFFmpeg, Error, TEXT("Can not allocate a new stream."));
 		StopCapture();
 		return;
 	}
 
-	Frame = av_frame_alloc();
-	if (Frame == nullptr) {
-		UE_LOG(LogFFmpeg, Error, TEXT("Cloud not allocate video frame."));
-		StopCapture();
-		return;
-	}
+	UE_LOG(LogFFmpeg, Log, TEXT("Converting captured frames with the %s kernel."), UTF8_TO_TCHAR(VideoEncoder->GetConversionName()));
 
-	Frame->format = CodecCtx->pix_fmt;
-	Frame->width = CodecCtx->width;
-	Frame->height = CodecCtx->height;
+	AVDictionary* MuxerOptions = nullptr;
+	VideoEncoderOptions::ApplyMuxer(Muxer->GetOutputFormat(), CaptureConfigs, &MuxerOptions);
 
-	result = av_frame_get_buffer(Frame, 0);
-	if (result < 0) {
-		UE_LOG(LogFFmpeg, Error, TEXT("Cloud not allocate the video frame data."));
+	if (!Muxer->Start(Writer->GetIOContext(), &MuxerOptions)) {
+		UE_LOG(LogFFmpeg, Error, TEXT("Error ocurred when write header into file."));
 		StopCapture();
 		return;
 	}
@@ -168,6 +141,16 @@ void UVideoCaptureComponent::StartCapture(const FString& InVideoFilename)
 	FrameTimeForCapture = FTimespan::FromSeconds(CaptureConfigs.FrameRate.Y / (CaptureConfigs.FrameRate.X * 1.0f));
 	PassedTime = FrameTimeForCapture;
 
+	// Every tick is then exactly one video frame, see TickComponent().
+	if (CaptureConfigs.bFixedTimestep) {
+		bSavedUseFixedTimeStep = FApp::UseFixedTimeStep();
+		SavedFixedDeltaTime = FApp::GetFixedDeltaTime();
+		bFixedTimestepApplied = true;
+
+		FApp::SetUseFixedTimeStep(true);
+		FApp::SetFixedDeltaTime(double(CaptureConfigs.FrameRate.Y) / CaptureConfigs.FrameRate.X);
+	}
+
 	CaptureState = EMovieCaptureState::Initialized;
 }
 
@@ -182,8 +165,29 @@ bool UVideoCaptureComponent::CaptureThisFrame(int32 CurrentFrame)
 		return false;
 	}
 
-	FrameGrabber->CaptureThisFrame(FFramePayloadPtr());
-	TArray<FCapturedFrameData> frames = FrameGrabber->GetCapturedFrames();
+	TArray<FCapturedFrameData> frames;
+	{
+		EASYFFMPEG_SCOPE_CYCLE_COUNTER(STAT_EasyFFMPEG_MapReadback);
+
+		// The grabber drops a frame when all its surfaces are still waiting, a fixed timestep capture waits for them instead.
+		if (CaptureConfigs.bFixedTimestep && PendingGrabberFrames >= GrabberSurfaceCount - 1) {
+			FlushRenderingCommands();
+		}
+
+		FrameGrabber->CaptureThisFrame(MakeShared<FCaptureTimePayload, ESPMode::ThreadSafe>());
+		frames = FrameGrabber->GetCapturedFrames();
+		PendingGrabberFrames = FMath::Max(PendingGrabberFrames + 1 - frames.Num(), 0);
+	}
+
+	// Every frame that came back, in order, stamped by how many were encoded so the timestamps have no holes.
+	if (CaptureConfigs.bFixedTimestep) {
+		for (FCapturedFrameData& Frame : frames)
+		{
+			WriteFrameToFile(Frame.ColorBuffer, EncodedFrameNumber++, GetCaptureCycles(Frame));
+		}
+		return frames.Num() > 0;
+	}
+
 	if (!frames.IsValidIndex(0)) {
 		if (CurrentFrame == 0) {
 			ShouldCutFrameCount++;
@@ -193,25 +197,57 @@ bool UVideoCaptureComponent::CaptureThisFrame(int32 CurrentFrame)
 
 	if (ShouldCutFrameCount > 1) {
 		ShouldCutFrameCount--;
+		DroppedFrameCount += frames.Num();
 		return true;
 	}
 
+	// Only the newest frame is encoded, the older ones the grabber returned with it are skipped.
+	DroppedFrameCount += frames.Num() - 1;
+
 	FCapturedFrameData& lastFrame = frames.Last();
 
-	WriteFrameToFile(lastFrame.ColorBuffer, CurrentFrame);
+	WriteFrameToFile(lastFrame.ColorBuffer, CurrentFrame, GetCaptureCycles(lastFrame));
 
 	return true;
 }
 
 void UVideoCaptureComponent::StopCapture()
 {
+	EASYFFMPEG_SCOPE_CYCLE_COUNTER(STAT_EasyFFMPEG_StopCapture);
+
+	if (bFixedTimestepApplied) {
+		FApp::SetUseFixedTimeStep(bSavedUseFixedTimeStep);
+		FApp::SetFixedDeltaTime(SavedFixedDeltaTime);
+		bFixedTimestepApplied = false;
+	}
+
+	// The frames still in the grabber belong to the capture too, except the one requested this tick which is not rendered yet.
+	if (CaptureConfigs.bFixedTimestep && IsInitialized() && FrameGrabber.IsValid()) {
+		FlushRenderingCommands();
+		for (FCapturedFrameData& Frame : FrameGrabber->GetCapturedFrames())
+		{
+			WriteFrameToFile(Frame.ColorBuffer, EncodedFrameNumber++, GetCaptureCycles(Frame));
+		}
+	}
+
 	ReleaseFrameGrabber();
-	DestroyVideoFileWriter();
 	ReleaseContext();
+	DestroyVideoFileWriter();
 
 	CaptureState = EMovieCaptureState::NotInit;
 }
 
+FCaptureStats UVideoCaptureComponent::GetCaptureStats() const
+{
+	FCaptureStats Stats;
+	Telemetry.GetStats(Stats);
+
+	Stats.DroppedFrames = DroppedFrameCount;
+	Stats.DuplicatedFrames = VideoEncoder != nullptr ? VideoEncoder->GetElidedFrameCount() : ElidedFrameCount;
+
+	return Stats;
+}
+
 // Called when the game starts
 void UVideoCaptureComponent::BeginPlay()
 {
@@ -229,16 +265,11 @@ void UVideoCaptureComponent::BeginDestroy()
 
 bool UVideoCaptureComponent::CreateVideoFileWriter()
 {
-	if (IFileManager::Get().FileExists(*VideoFilename)) {
-		IFileManager::Get().Delete(*VideoFilename);
-	}
+	DestroyVideoFileWriter();
 
-	Writer = IFileManager::Get().CreateFileWriter(*VideoFilename, EFileWrite::FILEWRITE_Append);
-	if (Writer == nullptr) {
-		return false;
-	}
+	Writer = new FVideoCaptureFileWriter(CaptureConfigs.IOBufferSizeMB * 1024 * 1024, CaptureConfigs.IOBufferCount, CaptureConfigs.bFragmentedOutput);
 
-	return true;
+	return Writer->Open(VideoFilename);
 }
 
 void UVideoCaptureComponent::DestroyVideoFileWriter()
@@ -247,8 +278,9 @@ void UVideoCaptureComponent::DestroyVideoFileWriter()
 		return;
 	}
 
-	Writer->Flush();
-	Writer->Close();
+	if (!Writer->Close()) {
+		UE_LOG(LogFFmpeg, Error, TEXT("Writing the video file '%s' failed, it is incomplete."), *VideoFilename);
+	}
 
 	delete Writer;
 	Writer = nullptr;
@@ -300,7 +332,7 @@ bool UVideoCaptureComponent::InitFrameGrabber(const FIntPoint& ViewportSize)
 		return false;
 	}
 	
-	FrameGrabber = MakeShareable(new FFrameGrabber(sceneViewport.ToSharedRef(), ViewportSize));
+	FrameGrabber = MakeShareable(new FFrameGrabber(sceneViewport.ToSharedRef(), ViewportSize, PF_B8G8R8A8, GrabberSurfaceCount));
 	FrameGrabber->StartCapturingFrames();
 
 	return true;
@@ -318,105 +350,40 @@ void UVideoCaptureComponent::ReleaseFrameGrabber()
 
 void UVideoCaptureComponent::ReleaseContext()
 {
-	if (CaptureState != EMovieCaptureState::NotInit) {
-		EncodeVideoFrame(CodecCtx, nullptr, Packet);
-
-		av_write_trailer(FormatCtx);
-	}
-
-	if (CodecCtx != nullptr) {
-		avcodec_free_context(&CodecCtx);
-		CodecCtx = nullptr;
-	}
-
-	if (FormatCtx != nullptr) {
-		if (FormatCtx->pb != nullptr) {
-			avio_close(FormatCtx->pb);
+	if (VideoEncoder != nullptr) {
+		if (CaptureState != EMovieCaptureState::NotInit) {
+			VideoEncoder->Flush();
 		}
-		avformat_free_context(FormatCtx);
-		FormatCtx = nullptr;
-	}
 
-	if (Frame != nullptr) {
-		av_frame_free(&Frame);
-		Frame = nullptr;
-	}
+		ElidedFrameCount = VideoEncoder->GetElidedFrameCount();
 
-	if (Packet != nullptr) {
-		av_packet_free(&Packet);
-		Packet = nullptr;
+		delete VideoEncoder;
+		VideoEncoder = nullptr;
 	}
-}
 
-void UVideoCaptureComponent::WriteFrameToFile(const TArray<FColor>& ColorBuffer, int32 CurrentFrame)
-{
-	AVFrame* rgbFrame = av_frame_alloc();
-	if (rgbFrame == nullptr) {
-		return;
-	}
-
-	avpicture_fill((AVPicture*)rgbFrame, (uint8_t*)ColorBuffer.GetData(), AV_PIX_FMT_BGRA, CodecCtx->width, CodecCtx->height);
-
-	SwsContext* scaleCtx = sws_getContext(CodecCtx->width, CodecCtx->height, AV_PIX_FMT_BGRA,
-										  CodecCtx->width, CodecCtx->height, CodecCtx->pix_fmt, SWS_BILINEAR, nullptr, nullptr, nullptr);
-	if (scaleCtx == nullptr) {
-		av_frame_free(&rgbFrame);
-		return;
-	}
-
-	int32 result = sws_scale(scaleCtx, rgbFrame->data, rgbFrame->linesize, 0, CodecCtx->height, Frame->data, Frame->linesize);
-	
-	av_frame_free(&rgbFrame);
-	sws_freeContext(scaleCtx);
-
-	Frame->pts = CurrentFrame;
+	// Writes the trailer if the header was written, the IO context belongs to the file writer.
+	if (Muxer != nullptr) {
+		if (!Muxer->Finish()) {
+			UE_LOG(LogFFmpeg, Error, TEXT("Muxing the video file '%s' failed."), *VideoFilename);
+		}
 
-	if (result != CodecCtx->height) {
-		return;
+		delete Muxer;
+		Muxer = nullptr;
 	}
-
-	EncodeVideoFrame(CodecCtx, Frame, Packet);
 }
 
-void UVideoCaptureComponent::EncodeVideoFrame(struct AVCodecContext* InCodecCtx, struct AVFrame* InFrame, struct AVPacket* InPacket)
+void UVideoCaptureComponent::WriteFrameToFile(const TArray<FColor>& ColorBuffer, int32 CurrentFrame, uint64 CaptureCycles)
 {
-	int32 result = avcodec_send_frame(InCodecCtx, InFrame);
-	if (result < 0) {
-		UE_LOG(LogFFmpeg, Error, TEXT("Error sending a frame for encoding."));
-		return;
-	}
+	const uint8* ColorData = reinterpret_cast<const uint8*>(ColorBuffer.GetData());
+	const int32 RowPitch = VideoEncoder->GetSettings().Width * sizeof(FColor);
 
-	while(result >= 0)
-	{
-
-		InPacket->data = nullptr;
-		InPacket->size = 0;
-
-		result = avcodec_receive_packet(InCodecCtx, InPacket);
-		if (result == AVERROR(EAGAIN) || result == AVERROR_EOF) {
-			return;
-		}
-		else if (result < 0) {
-			UE_LOG(LogFFmpeg, Error, TEXT("Error during encoding."));
-			return;
-		}
-
-		AVRational tempRational;
-		tempRational.num = CaptureConfigs.FrameRate.Y;
-		tempRational.den = CaptureConfigs.FrameRate.X;
-
-		av_packet_rescale_ts(InPacket, tempRational, Stream->time_base);
+	EASYFFMPEG_SCOPE_CYCLE_COUNTER(STAT_EasyFFMPEG_EncodeFrame);
 
-		InPacket->stream_index = Stream->index;
+	VideoEncoder->EncodeBGRA(ColorData, RowPitch, CurrentFrame);
+	Telemetry.AddEncodedFrame(FPlatformTime::Cycles64() - CaptureCycles);
 
-		result = av_interleaved_write_frame(FormatCtx, InPacket);
-		if (result < 0) {
-			UE_LOG(LogFFmpeg, Error, TEXT("Error during interleaved write frame."));
-			return;
-		}
-
-		av_packet_unref(InPacket);
-	}
+	VideoCaptureStats::AddFrameTiming(VideoEncoder->GetLastFrameTiming());
+	SET_DWORD_STAT(STAT_EasyFFMPEG_ElidedFrames, VideoEncoder->GetElidedFrameCount());
 }
 
 // Called every frame
@@ -431,9 +398,17 @@ void UVideoCaptureComponent::TickComponent(float DeltaTime, ELevelTick TickType,
 
 	PassedTime += FTimespan::FromSeconds(DeltaTime);
 	
-	if (PassedTime >= FrameTimeForCapture)
+	if (CaptureConfigs.bFixedTimestep || PassedTime >= FrameTimeForCapture)
 	{
 		CaptureThisFrame(CapturedFrameNumber++);
 		PassedTime = FTimespan::Zero();
 	}
+
+	if (CaptureConfigs.StatsInterval > 0.f) {
+		StatsElapsedTime += DeltaTime;
+		if (StatsElapsedTime >= CaptureConfigs.StatsInterval) {
+			StatsElapsedTime = 0.f;
+			OnCaptureStatsUpdated.Broadcast(GetCaptureStats());
+		}
+	}
 }
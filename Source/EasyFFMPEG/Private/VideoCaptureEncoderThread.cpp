@@ -0,0 +1,135 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "VideoCaptureEncoderThread.h"
+
+#include "HAL/RunnableThread.h"
+#include "EasyFFMPEG.h"
+
+FVideoCaptureEncoderThread::FVideoCaptureEncoderThread(int32 InMaxQueueDepth, FEncodeFrameFunction InEncodeFrame)
+	: EncodeFrame(MoveTemp(InEncodeFrame))
+	, QueuedFrames(FMath::Max(InMaxQueueDepth, 1) + 1)
+	, FreeFrames(FMath::Max(InMaxQueueDepth, 1) + 1)
+	, bStopping(false)
+	, WorkEvent(nullptr)
+	, FrameFreedEvent(nullptr)
+	, Thread(nullptr)
+{
+	for (int32 Index = 0; Index < FMath::Max(InMaxQueueDepth, 1); Index++)
+	{
+		FramePool.Add(MakeUnique<FCapturedVideoFrame>());
+		FreeFrames.Enqueue(FramePool.Last().Get());
+	}
+}
+
+FVideoCaptureEncoderThread::~FVideoCaptureEncoderThread()
+{
+	StopAndFlush();
+}
+
+bool FVideoCaptureEncoderThread::Start()
+{
+	check(Thread == nullptr);
+
+	bStopping = false;
+	WorkEvent = FPlatformProcess::GetSynchEventFromPool(false);
+	FrameFreedEvent = FPlatformProcess::GetSynchEventFromPool(false);
+	Thread = FRunnableThread::Create(this, TEXT("VideoCaptureEncoder"), 0, TPri_AboveNormal);
+
+	return Thread != nullptr;
+}
+
+void FVideoCaptureEncoderThread::StopAndFlush()
+{
+	if (Thread != nullptr) {
+		Stop();
+		Thread->WaitForCompletion();
+
+		delete Thread;
+		Thread = nullptr;
+	}
+
+	if (WorkEvent != nullptr) {
+		FPlatformProcess::ReturnSynchEventToPool(WorkEvent);
+		WorkEvent = nullptr;
+	}
+
+	if (FrameFreedEvent != nullptr) {
+		FPlatformProcess::ReturnSynchEventToPool(FrameFreedEvent);
+		FrameFreedEvent = nullptr;
+	}
+}
+
+FCapturedVideoFrame* FVideoCaptureEncoderThread::AcquireFrame()
+{
+	FCapturedVideoFrame* FreeFrame = nullptr;
+
+	if (Thread == nullptr || bStopping || !FreeFrames.Dequeue(FreeFrame)) {
+		DroppedFrameCount.Increment();
+		UE_LOG(LogFFmpeg, Verbose, TEXT("Encoder queue is full, dropping a captured frame."));
+		return nullptr;
+	}
+
+	return FreeFrame;
+}
+
+FCapturedVideoFrame* FVideoCaptureEncoderThread::WaitForFrame()
+{
+	FCapturedVideoFrame* FreeFrame = nullptr;
+
+	while (Thread != nullptr && !bStopping && !FreeFrames.Dequeue(FreeFrame))
+	{
+		FrameFreedEvent->Wait();
+	}
+
+	return FreeFrame;
+}
+
+void FVideoCaptureEncoderThread::EnqueueFrame(FCapturedVideoFrame* InFrame)
+{
+	check(InFrame != nullptr);
+
+	QueueDepth.Increment();
+	QueuedFrames.Enqueue(InFrame);
+	WorkEvent->Trigger();
+}
+
+uint32 FVideoCaptureEncoderThread::Run()
+{
+	while (true)
+	{
+		FCapturedVideoFrame* CapturedFrame = nullptr;
+		if (QueuedFrames.Dequeue(CapturedFrame)) {
+			EncodeFrame(*CapturedFrame);
+			QueueDepth.Decrement();
+
+			CapturedFrame->ColorData = nullptr;
+			CapturedFrame->ReadbackSlot = INDEX_NONE;
+			FreeFrames.Enqueue(CapturedFrame);
+			FrameFreedEvent->Trigger();
+			continue;
+		}
+
+		// Only leave once the queue is drained, so stopping never loses a frame that was already read back.
+		if (bStopping) {
+			break;
+		}
+
+		WorkEvent->Wait();
+	}
+
+	return 0;
+}
+
+void FVideoCaptureEncoderThread::Stop()
+{
+	bStopping = true;
+
+	if (WorkEvent != nullptr) {
+		WorkEvent->Trigger();
+	}
+
+	if (FrameFreedEvent != nullptr) {
+		FrameFreedEvent->Trigger();
+	}
+}
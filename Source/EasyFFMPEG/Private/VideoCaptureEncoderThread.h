@@ -0,0 +1,91 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/Runnable.h"
+#include "HAL/ThreadSafeBool.h"
+#include "HAL/ThreadSafeCounter.h"
+#include "Containers/CircularQueue.h"
+
+/** A frame read back from the GPU, waiting to be converted and encoded. */
+struct FCapturedVideoFrame
+{
+	/** First pixel of the BGRA frame, either inside a staging surface that stays mapped or inside Buffer. */
+	const uint8* ColorData = nullptr;
+
+	/** Bytes between the start of two rows, staging surfaces are usually wider than the viewport. */
+	int32 RowPitch = 0;
+
+	int32 FrameNumber = 0;
+
+	/** FPlatformTime::Cycles64() when the frame was captured. */
+	uint64 CaptureCycles = 0;
+
+	/** Readback slot the encoder reads in place, INDEX_NONE when the pixels were copied into Buffer. */
+	int32 ReadbackSlot = INDEX_NONE;
+
+	/** Pooled storage for frames that must outlive the map, only grows during the first captured frames. */
+	TArray<uint8> Buffer;
+};
+
+/**
+ * Worker thread that converts and encodes captured frames, so the render thread only has to enqueue them.
+ * Frames come from a fixed pool: when the encoder falls behind new frames are dropped instead of stalling the producer.
+ */
+class FVideoCaptureEncoderThread : public FRunnable
+{
+public:
+	typedef TFunction<void(const FCapturedVideoFrame& Frame)> FEncodeFrameFunction;
+
+	FVideoCaptureEncoderThread(int32 InMaxQueueDepth, FEncodeFrameFunction InEncodeFrame);
+
+	virtual ~FVideoCaptureEncoderThread();
+
+	bool Start();
+
+	/** Encodes every frame still queued and joins the thread. */
+	void StopAndFlush();
+
+	/** Single producer only. Returns an unused frame, or nullptr and counts a dropped frame if the queue is full. */
+	FCapturedVideoFrame* AcquireFrame();
+
+	/** Single producer only. Like AcquireFrame() but waits for the encoder to free a frame instead of dropping one, nullptr once stopping. */
+	FCapturedVideoFrame* WaitForFrame();
+
+	/** Single producer only. Hands a frame returned by AcquireFrame() over to the encoder. */
+	void EnqueueFrame(FCapturedVideoFrame* InFrame);
+
+	/** For frames the producer had to give up on before they reached the queue. */
+	void CountDroppedFrame() { DroppedFrameCount.Increment(); }
+
+	int32 GetQueueDepth() const { return QueueDepth.GetValue(); }
+
+	int32 GetDroppedFrameCount() const { return DroppedFrameCount.GetValue(); }
+
+	//~ Begin FRunnable interface
+	virtual uint32 Run() override;
+	virtual void Stop() override;
+	//~ End FRunnable interface
+
+private:
+	FEncodeFrameFunction EncodeFrame;
+
+	TArray<TUniquePtr<FCapturedVideoFrame>> FramePool;
+
+	/** Lock free, producer -> encoder */
+	TCircularQueue<FCapturedVideoFrame*> QueuedFrames;
+
+	/** Lock free, encoder -> producer */
+	TCircularQueue<FCapturedVideoFrame*> FreeFrames;
+
+	FThreadSafeCounter QueueDepth;
+	FThreadSafeCounter DroppedFrameCount;
+
+	FThreadSafeBool bStopping;
+	FEvent* WorkEvent;
+
+	/** Triggered every time the encoder returns a frame to FreeFrames, for WaitForFrame(). */
+	FEvent* FrameFreedEvent;
+	FRunnableThread* Thread;
+};
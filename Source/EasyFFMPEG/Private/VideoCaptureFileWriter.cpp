@@ -0,0 +1,327 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "VideoCaptureFileWriter.h"
+
+#include "HAL/RunnableThread.h"
+#include "HAL/PlatformFilemanager.h"
+#include "Misc/Paths.h"
+#include "EasyFFMPEG.h"
+#include "VideoCaptureStats.h"
+
+extern "C" {
+#include "libavutil/mem.h"
+#include "libavutil/error.h"
+}
+
+/** Size of the AVIOContext's own buffer, the muxer's writes reach us in chunks of this size. */
+static constexpr int32 IOContextBufferSize = 64 * 1024;
+
+/** Disk friendly alignment of the large buffers. */
+static constexpr uint32 BufferAlignment = 4096;
+
+FVideoCaptureFileWriter::FVideoCaptureFileWriter(int32 InBufferSize, int32 InBufferCount, bool bInSubmitOnFragments)
+	: BufferSize(Align(FMath::Max(InBufferSize, IOContextBufferSize), BufferAlignment))
+	, bSubmitOnFragments(bInSubmitOnFragments)
+	, QueuedBuffers(FMath::Max(InBufferCount, 2) + 1)
+	, FreeBuffers(FMath::Max(InBufferCount, 2) + 1)
+	, CurrentBuffer(nullptr)
+	, Position(0)
+	, FileSize(0)
+	, IOCtx(nullptr)
+	, FileHandle(nullptr)
+	, bWriteFailed(false)
+	, bStopping(false)
+	, WorkEvent(nullptr)
+	, BufferFreedEvent(nullptr)
+	, Thread(nullptr)
+{
+	Buffers.SetNum(FMath::Max(InBufferCount, 2));
+}
+
+FVideoCaptureFileWriter::~FVideoCaptureFileWriter()
+{
+	Close();
+}
+
+bool FVideoCaptureFileWriter::Open(const FString& Filename)
+{
+	check(FileHandle == nullptr);
+
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+	PlatformFile.CreateDirectoryTree(*FPaths::GetPath(Filename));
+
+	FileHandle = PlatformFile.OpenWrite(*Filename);
+	if (FileHandle == nullptr) {
+		return false;
+	}
+
+	for (FBuffer& Buffer : Buffers)
+	{
+		Buffer.Data = static_cast<uint8*>(FMemory::Malloc(BufferSize, BufferAlignment));
+		FreeBuffers.Enqueue(&Buffer);
+
+		INC_MEMORY_STAT_BY(STAT_EasyFFMPEG_IOBufferMemory, BufferSize);
+	}
+
+	uint8* IOContextBuffer = static_cast<uint8*>(av_malloc(IOContextBufferSize));
+	IOCtx = avio_alloc_context(IOContextBuffer, IOContextBufferSize, 1, this, nullptr, &FVideoCaptureFileWriter::WritePacket, &FVideoCaptureFileWriter::SeekPacket);
+	if (IOCtx == nullptr) {
+		av_free(IOContextBuffer);
+		return false;
+	}
+
+	// Setting write_data_type also makes the context flush its own buffer at every marker, so the previous fragment
+	// has been passed to Write() completely by the time the next one's first bytes arrive.
+	if (bSubmitOnFragments) {
+		IOCtx->write_data_type = &FVideoCaptureFileWriter::WriteMarkedPacket;
+		IOCtx->ignore_boundary_point = 0;
+	}
+
+	bStopping = false;
+	WorkEvent = FPlatformProcess::GetSynchEventFromPool(false);
+	BufferFreedEvent = FPlatformProcess::GetSynchEventFromPool(false);
+	Thread = FRunnableThread::Create(this, TEXT("VideoCaptureFileWriter"), 0, TPri_Normal);
+
+	return Thread != nullptr;
+}
+
+bool FVideoCaptureFileWriter::Close()
+{
+	if (FileHandle == nullptr) {
+		return !bWriteFailed;
+	}
+
+	if (IOCtx != nullptr) {
+		avio_flush(IOCtx);
+
+		av_freep(&IOCtx->buffer);
+		avio_context_free(&IOCtx);
+	}
+
+	SubmitCurrentBuffer();
+
+	if (Thread != nullptr) {
+		Stop();
+		Thread->WaitForCompletion();
+
+		delete Thread;
+		Thread = nullptr;
+	}
+
+	// Whatever the thread could not pick up, e.g. when it failed to start.
+	FBuffer* QueuedBuffer = nullptr;
+	while (QueuedBuffers.Dequeue(QueuedBuffer))
+	{
+		WriteBufferToDisk(*QueuedBuffer);
+	}
+
+	if (WorkEvent != nullptr) {
+		FPlatformProcess::ReturnSynchEventToPool(WorkEvent);
+		WorkEvent = nullptr;
+	}
+
+	if (BufferFreedEvent != nullptr) {
+		FPlatformProcess::ReturnSynchEventToPool(BufferFreedEvent);
+		BufferFreedEvent = nullptr;
+	}
+
+	FileHandle->Flush();
+
+	delete FileHandle;
+	FileHandle = nullptr;
+
+	if (StallCount.GetValue() > 0) {
+		UE_LOG(LogFFmpeg, Warning, TEXT("The muxer waited %d times for the disk, consider more or larger IO buffers."), StallCount.GetValue());
+	}
+
+	FBuffer* FreeBuffer = nullptr;
+	while (FreeBuffers.Dequeue(FreeBuffer))
+	{
+	}
+
+	for (FBuffer& Buffer : Buffers)
+	{
+		if (Buffer.Data != nullptr) {
+			DEC_MEMORY_STAT_BY(STAT_EasyFFMPEG_IOBufferMemory, BufferSize);
+		}
+
+		FMemory::Free(Buffer.Data);
+		Buffer = FBuffer();
+	}
+
+	CurrentBuffer = nullptr;
+
+	return !bWriteFailed;
+}
+
+int FVideoCaptureFileWriter::WritePacket(void* Opaque, uint8* Data, int Size)
+{
+	return static_cast<FVideoCaptureFileWriter*>(Opaque)->Write(Data, Size);
+}
+
+int FVideoCaptureFileWriter::WriteMarkedPacket(void* Opaque, uint8* Data, int Size, AVIODataMarkerType Type, int64_t Time)
+{
+	FVideoCaptureFileWriter* Writer = static_cast<FVideoCaptureFileWriter*>(Opaque);
+
+	// Later chunks of a fragment come as AVIO_DATA_MARKER_UNKNOWN, only its first bytes carry the sync / boundary point.
+	if (Type == AVIO_DATA_MARKER_SYNC_POINT || Type == AVIO_DATA_MARKER_BOUNDARY_POINT) {
+		Writer->SubmitCurrentBuffer();
+	}
+
+	return Writer->Write(Data, Size);
+}
+
+int64 FVideoCaptureFileWriter::SeekPacket(void* Opaque, int64 Offset, int Whence)
+{
+	return static_cast<FVideoCaptureFileWriter*>(Opaque)->Seek(Offset, Whence);
+}
+
+int32 FVideoCaptureFileWriter::Write(const uint8* Data, int32 Size)
+{
+	int32 Written = 0;
+	while (Written < Size)
+	{
+		if (bWriteFailed || (CurrentBuffer == nullptr && !AcquireBuffer())) {
+			return AVERROR(EIO);
+		}
+
+		const int32 CopySize = FMath::Min(Size - Written, BufferSize - CurrentBuffer->Size);
+		FMemory::Memcpy(CurrentBuffer->Data + CurrentBuffer->Size, Data + Written, CopySize);
+
+		CurrentBuffer->Size += CopySize;
+		Written += CopySize;
+		Position += CopySize;
+
+		if (CurrentBuffer->Size == BufferSize) {
+			SubmitCurrentBuffer();
+		}
+	}
+
+	FileSize = FMath::Max(FileSize, Position);
+	return Size;
+}
+
+int64 FVideoCaptureFileWriter::Seek(int64 Offset, int32 Whence)
+{
+	if (Whence & AVSEEK_SIZE) {
+		return FileSize;
+	}
+
+	int64 NewPosition = 0;
+	switch (Whence & ~AVSEEK_FORCE)
+	{
+	case SEEK_SET:
+		NewPosition = Offset;
+		break;
+	case SEEK_CUR:
+		NewPosition = Position + Offset;
+		break;
+	case SEEK_END:
+		NewPosition = FileSize + Offset;
+		break;
+	default:
+		return AVERROR(EINVAL);
+	}
+
+	if (NewPosition < 0) {
+		return AVERROR(EINVAL);
+	}
+
+	if (NewPosition != Position) {
+		SubmitCurrentBuffer();
+		Position = NewPosition;
+
+		if (CurrentBuffer != nullptr) {
+			CurrentBuffer->FileOffset = Position;
+		}
+	}
+
+	return Position;
+}
+
+bool FVideoCaptureFileWriter::AcquireBuffer()
+{
+	bool bStalled = false;
+
+	while (!FreeBuffers.Dequeue(CurrentBuffer))
+	{
+		if (bWriteFailed || Thread == nullptr) {
+			CurrentBuffer = nullptr;
+			return false;
+		}
+
+		if (!bStalled) {
+			bStalled = true;
+			StallCount.Increment();
+			INC_DWORD_STAT(STAT_EasyFFMPEG_FileWriterStalls);
+		}
+
+		BufferFreedEvent->Wait();
+	}
+
+	CurrentBuffer->Size = 0;
+	CurrentBuffer->FileOffset = Position;
+	return true;
+}
+
+void FVideoCaptureFileWriter::SubmitCurrentBuffer()
+{
+	if (CurrentBuffer == nullptr || CurrentBuffer->Size == 0) {
+		return;
+	}
+
+	QueuedBuffers.Enqueue(CurrentBuffer);
+	CurrentBuffer = nullptr;
+
+	if (WorkEvent != nullptr) {
+		WorkEvent->Trigger();
+	}
+}
+
+void FVideoCaptureFileWriter::WriteBufferToDisk(FBuffer& Buffer)
+{
+	EASYFFMPEG_SCOPE_CYCLE_COUNTER(STAT_EasyFFMPEG_FileWrite);
+
+	if (bWriteFailed) {
+		return;
+	}
+
+	if ((FileHandle->Tell() != Buffer.FileOffset && !FileHandle->Seek(Buffer.FileOffset)) || !FileHandle->Write(Buffer.Data, Buffer.Size)) {
+		UE_LOG(LogFFmpeg, Error, TEXT("Could not write %d bytes at offset %lld into the capture file."), Buffer.Size, Buffer.FileOffset);
+		bWriteFailed = true;
+	}
+}
+
+uint32 FVideoCaptureFileWriter::Run()
+{
+	while (true)
+	{
+		FBuffer* QueuedBuffer = nullptr;
+		while (QueuedBuffers.Dequeue(QueuedBuffer))
+		{
+			WriteBufferToDisk(*QueuedBuffer);
+
+			QueuedBuffer->Size = 0;
+			FreeBuffers.Enqueue(QueuedBuffer);
+			BufferFreedEvent->Trigger();
+		}
+
+		if (bStopping) {
+			break;
+		}
+
+		WorkEvent->Wait();
+	}
+
+	return 0;
+}
+
+void FVideoCaptureFileWriter::Stop()
+{
+	bStopping = true;
+
+	if (WorkEvent != nullptr) {
+		WorkEvent->Trigger();
+	}
+}
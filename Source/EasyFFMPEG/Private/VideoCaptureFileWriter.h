@@ -0,0 +1,96 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/Runnable.h"
+#include "HAL/ThreadSafeBool.h"
+#include "HAL/ThreadSafeCounter.h"
+#include "Containers/CircularQueue.h"
+
+extern "C" {
+#include "libavformat/avio.h"
+}
+
+class IFileHandle;
+
+/**
+ * Output file behind a custom AVIOContext. The muxer's writes are copied into a few large buffers that a background
+ * thread flushes to disk, so a slow disk only ever blocks the muxer once every buffer is waiting to be written.
+ * Seeks (e.g. the mp4 muxer patching sizes in the trailer) are queued with the data, nothing is read back.
+ * For fragmented output the current buffer is also handed over whenever the muxer starts a new fragment, so completed
+ * fragments reach the disk right away instead of once a whole buffer is full.
+ */
+class FVideoCaptureFileWriter : public FRunnable
+{
+public:
+	FVideoCaptureFileWriter(int32 InBufferSize, int32 InBufferCount, bool bInSubmitOnFragments = false);
+
+	virtual ~FVideoCaptureFileWriter();
+
+	/** Creates or truncates the file and starts the I/O thread. */
+	bool Open(const FString& Filename);
+
+	/** Writes everything still buffered and closes the file. Returns false if any write failed. */
+	bool Close();
+
+	/** Hand this to AVFormatContext::pb together with AVFMT_FLAG_CUSTOM_IO, it stays owned by the writer. */
+	AVIOContext* GetIOContext() const { return IOCtx; }
+
+	/** Times the muxer had to wait for the disk because every buffer was full. */
+	int32 GetStallCount() const { return StallCount.GetValue(); }
+
+	//~ Begin FRunnable interface
+	virtual uint32 Run() override;
+	virtual void Stop() override;
+	//~ End FRunnable interface
+
+private:
+	struct FBuffer
+	{
+		uint8* Data = nullptr;
+		int32 Size = 0;
+
+		/** Where Data goes in the file. */
+		int64 FileOffset = 0;
+	};
+
+	static int WritePacket(void* Opaque, uint8* Data, int Size);
+	static int64 SeekPacket(void* Opaque, int64 Offset, int Whence);
+
+	/** Replaces WritePacket with bSubmitOnFragments, the muxer labels the first bytes of every fragment. */
+	static int WriteMarkedPacket(void* Opaque, uint8* Data, int Size, AVIODataMarkerType Type, int64_t Time);
+
+	int32 Write(const uint8* Data, int32 Size);
+	int64 Seek(int64 Offset, int32 Whence);
+
+	bool AcquireBuffer();
+	void SubmitCurrentBuffer();
+	void WriteBufferToDisk(FBuffer& Buffer);
+
+	const int32 BufferSize;
+	const bool bSubmitOnFragments;
+
+	TArray<FBuffer> Buffers;
+
+	/** Lock free, muxer -> I/O thread */
+	TCircularQueue<FBuffer*> QueuedBuffers;
+
+	/** Lock free, I/O thread -> muxer */
+	TCircularQueue<FBuffer*> FreeBuffers;
+
+	/** Muxer side state. */
+	FBuffer* CurrentBuffer;
+	int64 Position;
+	int64 FileSize;
+
+	AVIOContext* IOCtx;
+	IFileHandle* FileHandle;
+
+	FThreadSafeCounter StallCount;
+	FThreadSafeBool bWriteFailed;
+	FThreadSafeBool bStopping;
+	FEvent* WorkEvent;
+	FEvent* BufferFreedEvent;
+	FRunnableThread* Thread;
+};
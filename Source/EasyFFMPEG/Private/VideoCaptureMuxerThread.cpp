@@ -0,0 +1,200 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "VideoCaptureMuxerThread.h"
+#include "VideoCaptureSegmentWriter.h"
+
+#include "HAL/RunnableThread.h"
+#include "Misc/ScopeLock.h"
+#include "EasyFFMPEG.h"
+#include "VideoCaptureStats.h"
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+#include "libavformat/avformat.h"
+}
+
+FVideoCaptureMuxerThread::FVideoCaptureMuxerThread(AVFormatContext* InFormatCtx)
+	: FormatCtx(InFormatCtx)
+	, SegmentWriter(nullptr)
+	, PendingPackets(MaxPendingPackets + 1)
+	, FreePackets(MaxPendingPackets + 1)
+	, bStopping(false)
+	, WorkEvent(nullptr)
+	, PacketFreedEvent(nullptr)
+	, Thread(nullptr)
+{
+	AllocatePacketPool();
+}
+
+FVideoCaptureMuxerThread::FVideoCaptureMuxerThread(FVideoCaptureSegmentWriter* InSegmentWriter)
+	: FormatCtx(nullptr)
+	, SegmentWriter(InSegmentWriter)
+	, PendingPackets(MaxPendingPackets + 1)
+	, FreePackets(MaxPendingPackets + 1)
+	, bStopping(false)
+	, WorkEvent(nullptr)
+	, PacketFreedEvent(nullptr)
+	, Thread(nullptr)
+{
+	AllocatePacketPool();
+}
+
+FVideoCaptureMuxerThread::~FVideoCaptureMuxerThread()
+{
+	StopAndFlush();
+
+	for (AVPacket* Packet : PacketPool)
+	{
+		av_packet_free(&Packet);
+	}
+}
+
+void FVideoCaptureMuxerThread::AllocatePacketPool()
+{
+	for (int32 Index = 0; Index < MaxPendingPackets; Index++)
+	{
+		AVPacket* Packet = av_packet_alloc();
+		if (Packet == nullptr) {
+			break;
+		}
+
+		PacketPool.Add(Packet);
+		FreePackets.Enqueue(Packet);
+	}
+
+	if (PacketPool.Num() < MaxPendingPackets) {
+		UE_LOG(LogFFmpeg, Warning, TEXT("Could only allocate %d of %d muxer packets."), PacketPool.Num(), MaxPendingPackets);
+	}
+}
+
+bool FVideoCaptureMuxerThread::Start()
+{
+	check(Thread == nullptr);
+
+	bStopping = false;
+	WorkEvent = FPlatformProcess::GetSynchEventFromPool(false);
+	PacketFreedEvent = FPlatformProcess::GetSynchEventFromPool(false);
+	Thread = FRunnableThread::Create(this, TEXT("VideoCaptureMuxer"), 0, TPri_Normal);
+
+	return Thread != nullptr;
+}
+
+void FVideoCaptureMuxerThread::StopAndFlush()
+{
+	if (Thread != nullptr) {
+		Stop();
+		Thread->WaitForCompletion();
+
+		delete Thread;
+		Thread = nullptr;
+	}
+
+	if (WorkEvent != nullptr) {
+		FPlatformProcess::ReturnSynchEventToPool(WorkEvent);
+		WorkEvent = nullptr;
+	}
+
+	if (PacketFreedEvent != nullptr) {
+		FPlatformProcess::ReturnSynchEventToPool(PacketFreedEvent);
+		PacketFreedEvent = nullptr;
+	}
+
+	if (OverflowedPacketCount.GetValue() > 0) {
+		UE_LOG(LogFFmpeg, Warning, TEXT("The muxer fell behind, %d packets waited for a free slot."), OverflowedPacketCount.GetValue());
+	}
+
+	// Packets posted after the thread left are still written, in order, from the caller.
+	WritePendingPackets();
+}
+
+void FVideoCaptureMuxerThread::PostPacket(AVPacket* InPacket)
+{
+	if (PacketPool.Num() == 0) {
+		UE_LOG(LogFFmpeg, Error, TEXT("The muxer has no packets, dropping one."));
+		av_packet_unref(InPacket);
+		return;
+	}
+
+	FScopeLock PostPacketScope(&PostPacketLock);
+
+	AVPacket* QueuedPacket = nullptr;
+	bool bOverflowed = false;
+
+	while (!FreePackets.Dequeue(QueuedPacket))
+	{
+		if (!bOverflowed) {
+			bOverflowed = true;
+			OverflowedPacketCount.Increment();
+			INC_DWORD_STAT(STAT_EasyFFMPEG_MuxerOverflows);
+		}
+
+		// Nobody left to free a packet, write what is queued from here.
+		if (Thread == nullptr) {
+			WritePendingPackets();
+			continue;
+		}
+
+		PacketFreedEvent->Wait();
+	}
+
+	av_packet_move_ref(QueuedPacket, InPacket);
+
+	PendingPacketCount.Increment();
+	PendingPackets.Enqueue(QueuedPacket);
+
+	if (WorkEvent != nullptr) {
+		WorkEvent->Trigger();
+	}
+}
+
+void FVideoCaptureMuxerThread::WritePendingPackets()
+{
+	AVPacket* PendingPacket = nullptr;
+	while (PendingPackets.Dequeue(PendingPacket))
+	{
+		EASYFFMPEG_SCOPE_CYCLE_COUNTER(STAT_EasyFFMPEG_MuxPacket);
+
+		if (SegmentWriter != nullptr) {
+			SegmentWriter->WritePacket(PendingPacket);
+		}
+		// Takes over the packet's reference, even on failure.
+		else if (av_interleaved_write_frame(FormatCtx, PendingPacket) < 0) {
+			UE_LOG(LogFFmpeg, Error, TEXT("Error during interleaved write frame."));
+		}
+
+		// Both writers left it blank already, this only makes sure before it goes back to the pool.
+		av_packet_unref(PendingPacket);
+		PendingPacketCount.Decrement();
+
+		FreePackets.Enqueue(PendingPacket);
+		if (PacketFreedEvent != nullptr) {
+			PacketFreedEvent->Trigger();
+		}
+	}
+}
+
+uint32 FVideoCaptureMuxerThread::Run()
+{
+	while (true)
+	{
+		WritePendingPackets();
+
+		if (bStopping) {
+			break;
+		}
+
+		WorkEvent->Wait();
+	}
+
+	return 0;
+}
+
+void FVideoCaptureMuxerThread::Stop()
+{
+	bStopping = true;
+
+	if (WorkEvent != nullptr) {
+		WorkEvent->Trigger();
+	}
+}
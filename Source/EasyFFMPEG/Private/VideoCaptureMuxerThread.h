@@ -0,0 +1,80 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/Runnable.h"
+#include "HAL/ThreadSafeBool.h"
+#include "HAL/ThreadSafeCounter.h"
+#include "HAL/CriticalSection.h"
+#include "Containers/CircularQueue.h"
+
+struct AVFormatContext;
+struct AVPacket;
+class FVideoCaptureSegmentWriter;
+
+/**
+ * Owns every write into the output between avformat_write_header and av_write_trailer. The audio and video encoders
+ * post their packets from any thread, the muxer interleaves and writes them on its own thread so neither encoder
+ * waits on the disk. Packets come from a fixed pool: when the muxer falls that far behind the encoder posting the
+ * packet waits for it, encoded packets can't be dropped without breaking the stream.
+ */
+class FVideoCaptureMuxerThread : public FRunnable
+{
+public:
+	explicit FVideoCaptureMuxerThread(AVFormatContext* InFormatCtx);
+
+	/** Segmented output, every packet goes to InSegmentWriter which rotates the files. */
+	explicit FVideoCaptureMuxerThread(FVideoCaptureSegmentWriter* InSegmentWriter);
+
+	virtual ~FVideoCaptureMuxerThread();
+
+	bool Start();
+
+	/** Writes every packet still queued and joins the thread, the caller owns the format context again afterwards. */
+	void StopAndFlush();
+
+	/** Any thread. Takes over the packet's data (InPacket is left blank), timestamps must already be in the stream time base. */
+	void PostPacket(AVPacket* InPacket);
+
+	int32 GetPendingPacketCount() const { return PendingPacketCount.GetValue(); }
+
+	/** Packets that found the pool empty and had to wait for the muxer. */
+	int32 GetOverflowedPacketCount() const { return OverflowedPacketCount.GetValue(); }
+
+	//~ Begin FRunnable interface
+	virtual uint32 Run() override;
+	virtual void Stop() override;
+	//~ End FRunnable interface
+
+private:
+	void AllocatePacketPool();
+	void WritePendingPackets();
+
+	/** Packets the encoders can have in flight before they wait for the muxer, a few seconds of audio and video. */
+	static constexpr int32 MaxPendingPackets = 256;
+
+	AVFormatContext* FormatCtx;
+	FVideoCaptureSegmentWriter* SegmentWriter;
+
+	TArray<AVPacket*> PacketPool;
+
+	/** Lock free, encoders -> muxer */
+	TCircularQueue<AVPacket*> PendingPackets;
+
+	/** Lock free, muxer -> encoders */
+	TCircularQueue<AVPacket*> FreePackets;
+
+	/** Both queues take a single producer, the audio and video encoders post from their own threads. */
+	FCriticalSection PostPacketLock;
+
+	FThreadSafeCounter PendingPacketCount;
+	FThreadSafeCounter OverflowedPacketCount;
+
+	FThreadSafeBool bStopping;
+	FEvent* WorkEvent;
+
+	/** Triggered every time the muxer returns a packet to FreePackets, for PostPacket(). */
+	FEvent* PacketFreedEvent;
+	FRunnableThread* Thread;
+};
@@ -0,0 +1,226 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "VideoCaptureReplayBuffer.h"
+#include "VideoCaptureFileWriter.h"
+#include "EasyFFMPEG.h"
+
+#include "Misc/ScopeLock.h"
+#include "Misc/ScopeExit.h"
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+#include "libavformat/avformat.h"
+}
+
+FVideoCaptureReplayBuffer::FVideoCaptureReplayBuffer(double InMaxDuration, int64 InMaxBytes)
+	: MaxDuration(InMaxDuration)
+	, MaxBytes(InMaxBytes)
+	, BufferedBytes(0)
+	, NewestTime(0.0)
+{
+}
+
+FVideoCaptureReplayBuffer::~FVideoCaptureReplayBuffer()
+{
+	while (Gops.Num() > 0)
+	{
+		EvictGop();
+	}
+
+	for (FStream& Stream : Streams)
+	{
+		avcodec_parameters_free(&Stream.Params);
+	}
+}
+
+void FVideoCaptureReplayBuffer::AddStream(const AVCodecParameters* Params, int32 TimeBaseNum, int32 TimeBaseDen)
+{
+	FStream& Stream = Streams.AddDefaulted_GetRef();
+	Stream.Params = avcodec_parameters_alloc();
+	avcodec_parameters_copy(Stream.Params, Params);
+	Stream.TimeBaseNum = TimeBaseNum;
+	Stream.TimeBaseDen = TimeBaseDen;
+	Stream.bIsVideo = Params->codec_type == AVMEDIA_TYPE_VIDEO;
+}
+
+void FVideoCaptureReplayBuffer::AddPacket(AVPacket* InPacket)
+{
+	if (!Streams.IsValidIndex(InPacket->stream_index)) {
+		av_packet_unref(InPacket);
+		return;
+	}
+
+	const FStream& Stream = Streams[InPacket->stream_index];
+	const bool bStartsGop = Stream.bIsVideo && (InPacket->flags & AV_PKT_FLAG_KEY) != 0;
+	const double PacketTime = InPacket->pts * av_q2d({ Stream.TimeBaseNum, Stream.TimeBaseDen });
+
+	FScopeLock ScopeLock(&Lock);
+
+	// Nothing before the first keyframe could be decoded.
+	if (Gops.Num() == 0 && !bStartsGop) {
+		av_packet_unref(InPacket);
+		return;
+	}
+
+	if (bStartsGop) {
+		Gops.AddDefaulted_GetRef().StartTime = PacketTime;
+	}
+
+	AVPacket* BufferedPacket = av_packet_alloc();
+	av_packet_move_ref(BufferedPacket, InPacket);
+
+	FGop& Gop = Gops.Last();
+	Gop.Packets.Add(BufferedPacket);
+	Gop.Bytes += BufferedPacket->size;
+	BufferedBytes += BufferedPacket->size;
+
+	if (Stream.bIsVideo) {
+		NewestTime = FMath::Max(NewestTime, PacketTime);
+	}
+
+	// The oldest GOP goes once the rest still covers the duration, or regardless while over the memory budget.
+	// The newest GOP always stays.
+	while (Gops.Num() > 1 && (NewestTime - Gops[1].StartTime >= MaxDuration || BufferedBytes > MaxBytes))
+	{
+		EvictGop();
+	}
+}
+
+void FVideoCaptureReplayBuffer::EvictGop()
+{
+	for (AVPacket*& Packet : Gops[0].Packets)
+	{
+		av_packet_free(&Packet);
+	}
+
+	BufferedBytes -= Gops[0].Bytes;
+	Gops.RemoveAt(0, 1, false);
+}
+
+TArray<AVPacket*> FVideoCaptureReplayBuffer::Snapshot() const
+{
+	FScopeLock ScopeLock(&Lock);
+
+	TArray<AVPacket*> Packets;
+	for (const FGop& Gop : Gops)
+	{
+		for (const AVPacket* Packet : Gop.Packets)
+		{
+			Packets.Add(av_packet_clone(Packet));
+		}
+	}
+
+	return Packets;
+}
+
+bool FVideoCaptureReplayBuffer::WriteToFile(const FString& Filename, TArray<AVPacket*> Packets, int32 IOBufferSize, int32 IOBufferCount) const
+{
+	ON_SCOPE_EXIT
+	{
+		for (AVPacket*& Packet : Packets)
+		{
+			av_packet_free(&Packet);
+		}
+	};
+
+	if (Packets.Num() == 0) {
+		UE_LOG(LogFFmpeg, Warning, TEXT("The replay buffer is empty, nothing to save into '%s'."), *Filename);
+		return false;
+	}
+
+	AVFormatContext* OutputCtx = nullptr;
+	if (avformat_alloc_output_context2(&OutputCtx, nullptr, nullptr, TCHAR_TO_UTF8(*Filename)) < 0) {
+		UE_LOG(LogFFmpeg, Error, TEXT("Can not allocate format context for the replay '%s'."), *Filename);
+		return false;
+	}
+
+	ON_SCOPE_EXIT
+	{
+		OutputCtx->pb = nullptr;
+		avformat_free_context(OutputCtx);
+	};
+
+	for (const FStream& Stream : Streams)
+	{
+		AVStream* OutputStream = avformat_new_stream(OutputCtx, nullptr);
+		if (OutputStream == nullptr || avcodec_parameters_copy(OutputStream->codecpar, Stream.Params) < 0) {
+			UE_LOG(LogFFmpeg, Error, TEXT("Can not allocate a new stream."));
+			return false;
+		}
+
+		OutputStream->codecpar->codec_tag = 0;
+		OutputStream->time_base = { Stream.TimeBaseNum, Stream.TimeBaseDen };
+	}
+
+	FVideoCaptureFileWriter Writer(IOBufferSize, IOBufferCount);
+	if (!Writer.Open(Filename)) {
+		UE_LOG(LogFFmpeg, Error, TEXT("Cant create the replay file '%s'."), *Filename);
+		return false;
+	}
+
+	OutputCtx->pb = Writer.GetIOContext();
+	OutputCtx->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+	if (avformat_write_header(OutputCtx, nullptr) < 0) {
+		UE_LOG(LogFFmpeg, Error, TEXT("Error ocurred when write header into the replay '%s'."), *Filename);
+		Writer.Close();
+		return false;
+	}
+
+	// The snapshot starts on a video keyframe, its dts becomes 0 for every stream.
+	const AVPacket* FirstPacket = Packets[0];
+	const AVRational FirstTimeBase = { Streams[FirstPacket->stream_index].TimeBaseNum, Streams[FirstPacket->stream_index].TimeBaseDen };
+	const int64 StartTime = av_rescale_q(FirstPacket->dts, FirstTimeBase, AV_TIME_BASE_Q);
+
+	int32 FailedPackets = 0;
+	for (AVPacket*& Packet : Packets)
+	{
+		const FStream& Stream = Streams[Packet->stream_index];
+		const AVRational SourceTimeBase = { Stream.TimeBaseNum, Stream.TimeBaseDen };
+		const int64 StreamStartTime = av_rescale_q(StartTime, AV_TIME_BASE_Q, SourceTimeBase);
+
+		// Audio encoded just before the keyframe would end up with negative timestamps.
+		if (Packet->dts < StreamStartTime) {
+			continue;
+		}
+
+		Packet->pts -= StreamStartTime;
+		Packet->dts -= StreamStartTime;
+		av_packet_rescale_ts(Packet, SourceTimeBase, OutputCtx->streams[Packet->stream_index]->time_base);
+
+		if (av_interleaved_write_frame(OutputCtx, Packet) < 0) {
+			FailedPackets++;
+		}
+	}
+
+	bool bSucceeded = true;
+	if (FailedPackets > 0) {
+		UE_LOG(LogFFmpeg, Error, TEXT("%d packets could not be written into the replay '%s'."), FailedPackets, *Filename);
+		bSucceeded = false;
+	}
+
+	if (av_write_trailer(OutputCtx) < 0) {
+		UE_LOG(LogFFmpeg, Error, TEXT("Could not write the trailer of the replay '%s'."), *Filename);
+		bSucceeded = false;
+	}
+
+	// Closes the file either way, a truncated replay is still reported as failed.
+	bSucceeded &= Writer.Close();
+
+	return bSucceeded;
+}
+
+double FVideoCaptureReplayBuffer::GetBufferedSeconds() const
+{
+	FScopeLock ScopeLock(&Lock);
+
+	return Gops.Num() > 0 ? NewestTime - Gops[0].StartTime : 0.0;
+}
+
+int64 FVideoCaptureReplayBuffer::GetBufferedBytes() const
+{
+	FScopeLock ScopeLock(&Lock);
+
+	return BufferedBytes;
+}
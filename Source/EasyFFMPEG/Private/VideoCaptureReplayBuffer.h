@@ -0,0 +1,70 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/CriticalSection.h"
+
+struct AVPacket;
+struct AVCodecParameters;
+
+/**
+ * Instant replay: keeps the most recent encoded packets of every stream in memory instead of writing them out.
+ * Whole GOPs are evicted from the front, so the buffer always starts on a video keyframe and can be stream copied
+ * into a file without re-encoding. Bounded by both duration and memory.
+ */
+class FVideoCaptureReplayBuffer
+{
+public:
+	FVideoCaptureReplayBuffer(double InMaxDuration, int64 InMaxBytes);
+
+	~FVideoCaptureReplayBuffer();
+
+	/** Before the first packet, in stream index order. Copies Params. */
+	void AddStream(const AVCodecParameters* Params, int32 TimeBaseNum, int32 TimeBaseDen);
+
+	/** Any thread. Takes over the packet's data (InPacket is left blank), timestamps must be in the stream time base. */
+	void AddPacket(AVPacket* InPacket);
+
+	/** Any thread. References every buffered packet, oldest first, the caller frees them or hands them to WriteToFile(). */
+	TArray<AVPacket*> Snapshot() const;
+
+	/**
+	 * Blocking, for a worker thread. Muxes the packets of a snapshot into Filename, timestamps rebased to start at 0.
+	 * Frees the packets.
+	 */
+	bool WriteToFile(const FString& Filename, TArray<AVPacket*> Packets, int32 IOBufferSize, int32 IOBufferCount) const;
+
+	double GetBufferedSeconds() const;
+
+	int64 GetBufferedBytes() const;
+
+private:
+	/** A video keyframe and every packet of any stream that arrived after it, up to the next keyframe. */
+	struct FGop
+	{
+		TArray<AVPacket*> Packets;
+		double StartTime = 0.0;
+		int64 Bytes = 0;
+	};
+
+	struct FStream
+	{
+		AVCodecParameters* Params = nullptr;
+		int32 TimeBaseNum = 0;
+		int32 TimeBaseDen = 1;
+		bool bIsVideo = false;
+	};
+
+	void EvictGop();
+
+	const double MaxDuration;
+	const int64 MaxBytes;
+
+	TArray<FStream> Streams;
+
+	mutable FCriticalSection Lock;
+	TArray<FGop> Gops;
+	int64 BufferedBytes;
+	double NewestTime;
+};
@@ -0,0 +1,319 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "VideoCaptureSegmentWriter.h"
+#include "VideoCaptureFileWriter.h"
+#include "VideoEncoderOptions.h"
+#include "EasyFFMPEG.h"
+
+#include "Async/Async.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Misc/ScopeLock.h"
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+#include "libavformat/avformat.h"
+}
+
+FVideoCaptureSegmentWriter::FVideoCaptureSegmentWriter(const FString& InBaseFilename, const FCaptureConfigs& InCaptureConfigs)
+	: BaseFilename(InBaseFilename)
+	, CaptureConfigs(InCaptureConfigs)
+	, VideoStreamIndex(INDEX_NONE)
+	, bContinuousTimestamps(false)
+	, SegmentCount(0)
+	, DroppedPackets(0)
+	, PendingDroppedPackets(0)
+{
+}
+
+FVideoCaptureSegmentWriter::~FVideoCaptureSegmentWriter()
+{
+	Finish();
+
+	for (FStream& Stream : Streams)
+	{
+		avcodec_parameters_free(&Stream.Params);
+	}
+}
+
+bool FVideoCaptureSegmentWriter::Open(const AVFormatContext* TemplateCtx)
+{
+	for (uint32 Index = 0; Index < TemplateCtx->nb_streams; Index++)
+	{
+		const AVStream* TemplateStream = TemplateCtx->streams[Index];
+
+		FStream& Stream = Streams.AddDefaulted_GetRef();
+		Stream.Params = avcodec_parameters_alloc();
+		avcodec_parameters_copy(Stream.Params, TemplateStream->codecpar);
+		Stream.TimeBaseNum = TemplateStream->time_base.num;
+		Stream.TimeBaseDen = TemplateStream->time_base.den;
+		Stream.bIsVideo = TemplateStream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO;
+
+		if (Stream.bIsVideo && VideoStreamIndex == INDEX_NONE) {
+			VideoStreamIndex = Index;
+		}
+	}
+
+	if (VideoStreamIndex == INDEX_NONE) {
+		UE_LOG(LogFFmpeg, Error, TEXT("Segmented output needs a video stream to split on."));
+		return false;
+	}
+
+	bContinuousTimestamps = FCStringAnsi::Strcmp(TemplateCtx->oformat->name, "mpegts") == 0;
+
+	return OpenSegment();
+}
+
+FString FVideoCaptureSegmentWriter::GetSegmentFilename(int32 Index) const
+{
+	return FString::Printf(TEXT("%s_%05d.%s"), *FPaths::GetBaseFilename(BaseFilename, false), Index, *FPaths::GetExtension(BaseFilename));
+}
+
+bool FVideoCaptureSegmentWriter::OpenSegment()
+{
+	CurrentSegment = FSegment();
+	CurrentSegment.Index = SegmentCount++;
+
+	const FString Filename = GetSegmentFilename(CurrentSegment.Index);
+
+	if (avformat_alloc_output_context2(&CurrentSegment.FormatCtx, nullptr, nullptr, TCHAR_TO_UTF8(*Filename)) < 0) {
+		UE_LOG(LogFFmpeg, Error, TEXT("Can not allocate format context for the segment '%s'."), *Filename);
+		return false;
+	}
+
+	for (const FStream& Stream : Streams)
+	{
+		AVStream* OutputStream = avformat_new_stream(CurrentSegment.FormatCtx, nullptr);
+		if (OutputStream == nullptr || avcodec_parameters_copy(OutputStream->codecpar, Stream.Params) < 0) {
+			UE_LOG(LogFFmpeg, Error, TEXT("Can not allocate a new stream."));
+			CloseSegment(CurrentSegment);
+			return false;
+		}
+
+		OutputStream->codecpar->codec_tag = 0;
+		OutputStream->time_base = { Stream.TimeBaseNum, Stream.TimeBaseDen };
+	}
+
+	CurrentSegment.Writer = new FVideoCaptureFileWriter(CaptureConfigs.IOBufferSizeMB * 1024 * 1024, CaptureConfigs.IOBufferCount, CaptureConfigs.bFragmentedOutput);
+	if (!CurrentSegment.Writer->Open(Filename)) {
+		UE_LOG(LogFFmpeg, Error, TEXT("Cant create the segment file '%s'."), *Filename);
+		CloseSegment(CurrentSegment);
+		return false;
+	}
+
+	CurrentSegment.FormatCtx->pb = CurrentSegment.Writer->GetIOContext();
+	CurrentSegment.FormatCtx->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+	AVDictionary* MuxerOptions = nullptr;
+	VideoEncoderOptions::ApplyMuxer(CurrentSegment.FormatCtx->oformat, CaptureConfigs, &MuxerOptions);
+
+	const int32 Result = avformat_write_header(CurrentSegment.FormatCtx, &MuxerOptions);
+	VideoEncoderOptions::ReportUnusedAndFree(&MuxerOptions);
+	if (Result < 0) {
+		UE_LOG(LogFFmpeg, Error, TEXT("Error ocurred when write header into the segment '%s'."), *Filename);
+		// No trailer without a header.
+		CurrentSegment.FormatCtx->pb = nullptr;
+		CloseSegment(CurrentSegment);
+		return false;
+	}
+
+	UE_LOG(LogFFmpeg, Log, TEXT("Recording segment '%s'."), *Filename);
+
+	return true;
+}
+
+void FVideoCaptureSegmentWriter::WritePacket(AVPacket* InPacket)
+{
+	if (!Streams.IsValidIndex(InPacket->stream_index)) {
+		av_packet_unref(InPacket);
+		return;
+	}
+
+	const FStream& Stream = Streams[InPacket->stream_index];
+	const AVRational SourceTimeBase = { Stream.TimeBaseNum, Stream.TimeBaseDen };
+	const bool bIsVideo = InPacket->stream_index == VideoStreamIndex;
+
+	const bool bIsKeyframe = bIsVideo && (InPacket->flags & AV_PKT_FLAG_KEY) != 0;
+
+	if (bIsKeyframe && CurrentSegment.FormatCtx != nullptr && CurrentSegment.StartPts != INDEX_NONE) {
+		const double Elapsed = (InPacket->pts - CurrentSegment.StartPts) * av_q2d(SourceTimeBase);
+		const int64 Bytes = avio_tell(CurrentSegment.FormatCtx->pb);
+
+		const bool bDurationReached = CaptureConfigs.SegmentDuration > 0.f && Elapsed >= CaptureConfigs.SegmentDuration;
+		const bool bSizeReached = CaptureConfigs.SegmentMaxSizeMB > 0 && Bytes >= int64(CaptureConfigs.SegmentMaxSizeMB) * 1024 * 1024;
+
+		if (bDurationReached || bSizeReached) {
+			// The keyframe is where the last segment ends and the next one starts.
+			CurrentSegment.EndPts = InPacket->pts;
+			FinalizeSegment();
+
+			if (OpenSegment() && !bContinuousTimestamps) {
+				CurrentSegment.TimestampOffset = av_rescale_q(InPacket->dts, SourceTimeBase, AV_TIME_BASE_Q);
+			}
+		}
+	}
+	else if (bIsKeyframe && CurrentSegment.FormatCtx == nullptr) {
+		// A segment failed to open, a keyframe is the first place a new one can start.
+		if (OpenSegment()) {
+			if (!bContinuousTimestamps) {
+				CurrentSegment.TimestampOffset = av_rescale_q(InPacket->dts, SourceTimeBase, AV_TIME_BASE_Q);
+			}
+			UE_LOG(LogFFmpeg, Warning, TEXT("Segment output resumed, %lld packets were dropped while no segment was open."), PendingDroppedPackets);
+			PendingDroppedPackets = 0;
+		}
+	}
+
+	// Nowhere to write after a segment failed to open, the capture goes on until the next keyframe opens a new one.
+	if (CurrentSegment.FormatCtx == nullptr) {
+		if (PendingDroppedPackets == 0) {
+			UE_LOG(LogFFmpeg, Warning, TEXT("No segment is open, dropping packets until the next keyframe."));
+		}
+		PendingDroppedPackets++;
+		DroppedPackets++;
+		av_packet_unref(InPacket);
+		return;
+	}
+
+	if (bIsVideo) {
+		if (CurrentSegment.StartPts == INDEX_NONE) {
+			CurrentSegment.StartPts = InPacket->pts;
+		}
+		CurrentSegment.EndPts = FMath::Max(CurrentSegment.EndPts, InPacket->pts + FMath::Max<int64>(InPacket->duration, 1));
+	}
+
+	if (CurrentSegment.TimestampOffset != 0) {
+		const int64 StreamOffset = av_rescale_q(CurrentSegment.TimestampOffset, AV_TIME_BASE_Q, SourceTimeBase);
+		InPacket->pts -= StreamOffset;
+		InPacket->dts -= StreamOffset;
+	}
+
+	av_packet_rescale_ts(InPacket, SourceTimeBase, CurrentSegment.FormatCtx->streams[InPacket->stream_index]->time_base);
+
+	// Takes over the packet's reference, even on failure.
+	if (av_interleaved_write_frame(CurrentSegment.FormatCtx, InPacket) < 0) {
+		UE_LOG(LogFFmpeg, Error, TEXT("Error during interleaved write frame."));
+	}
+}
+
+void FVideoCaptureSegmentWriter::FinalizeSegment()
+{
+	if (CurrentSegment.FormatCtx == nullptr) {
+		return;
+	}
+
+	const double Duration = CurrentSegment.StartPts != INDEX_NONE
+		? (CurrentSegment.EndPts - CurrentSegment.StartPts) * av_q2d({ Streams[VideoStreamIndex].TimeBaseNum, Streams[VideoStreamIndex].TimeBaseDen })
+		: 0.0;
+
+	int32 EntryIndex;
+	{
+		FScopeLock ScopeLock(&PlaylistLock);
+
+		FPlaylistEntry& Entry = PlaylistEntries.AddDefaulted_GetRef();
+		Entry.Filename = FPaths::GetCleanFilename(GetSegmentFilename(CurrentSegment.Index));
+		Entry.Duration = Duration;
+		EntryIndex = PlaylistEntries.Num() - 1;
+	}
+
+	const FSegment Segment = CurrentSegment;
+	CurrentSegment = FSegment();
+
+	FinalizeTasks.Add(Async(EAsyncExecution::Thread, [this, Segment, EntryIndex]() mutable
+	{
+		const bool bSucceeded = CloseSegment(Segment);
+
+		FScopeLock ScopeLock(&PlaylistLock);
+
+		PlaylistEntries[EntryIndex].bFinalized = true;
+		PlaylistEntries[EntryIndex].bSucceeded = bSucceeded;
+
+		if (CaptureConfigs.bWriteSegmentPlaylist) {
+			WritePlaylist(false);
+		}
+
+		return bSucceeded;
+	}));
+}
+
+bool FVideoCaptureSegmentWriter::CloseSegment(FSegment& Segment)
+{
+	bool bSucceeded = Segment.FormatCtx != nullptr && Segment.Writer != nullptr;
+
+	if (Segment.FormatCtx != nullptr && Segment.FormatCtx->pb != nullptr) {
+		bSucceeded &= av_write_trailer(Segment.FormatCtx) == 0;
+	}
+
+	if (Segment.Writer != nullptr) {
+		bSucceeded &= Segment.Writer->Close();
+
+		delete Segment.Writer;
+		Segment.Writer = nullptr;
+	}
+
+	if (Segment.FormatCtx != nullptr) {
+		Segment.FormatCtx->pb = nullptr;
+		avformat_free_context(Segment.FormatCtx);
+		Segment.FormatCtx = nullptr;
+	}
+
+	return bSucceeded;
+}
+
+bool FVideoCaptureSegmentWriter::Finish()
+{
+	FinalizeSegment();
+
+	bool bSucceeded = true;
+	for (TFuture<bool>& Task : FinalizeTasks)
+	{
+		bSucceeded &= Task.Get();
+	}
+	FinalizeTasks.Empty();
+
+	// Gaps in the output count as a failure, the segments around them are still listed.
+	if (DroppedPackets > 0) {
+		UE_LOG(LogFFmpeg, Error, TEXT("%lld packets were dropped because a segment could not be opened."), DroppedPackets);
+		bSucceeded = false;
+	}
+
+	if (CaptureConfigs.bWriteSegmentPlaylist && PlaylistEntries.Num() > 0) {
+		FScopeLock ScopeLock(&PlaylistLock);
+		WritePlaylist(true);
+	}
+
+	return bSucceeded;
+}
+
+void FVideoCaptureSegmentWriter::WritePlaylist(bool bEnded)
+{
+	int32 TargetDuration = FMath::CeilToInt(CaptureConfigs.SegmentDuration);
+	for (const FPlaylistEntry& Entry : PlaylistEntries)
+	{
+		TargetDuration = FMath::Max(TargetDuration, FMath::CeilToInt(Entry.Duration));
+	}
+
+	FString Playlist = TEXT("#EXTM3U\n#EXT-X-VERSION:3\n#EXT-X-PLAYLIST-TYPE:EVENT\n");
+	Playlist += FString::Printf(TEXT("#EXT-X-TARGETDURATION:%d\n#EXT-X-MEDIA-SEQUENCE:0\n"), FMath::Max(TargetDuration, 1));
+
+	// Only segments whose trailers are written, and none past one still being finalized, so the list stays in order.
+	for (const FPlaylistEntry& Entry : PlaylistEntries)
+	{
+		if (!Entry.bFinalized) {
+			break;
+		}
+
+		if (Entry.bSucceeded) {
+			Playlist += FString::Printf(TEXT("#EXTINF:%.3f,\n%s\n"), Entry.Duration, *Entry.Filename);
+		}
+	}
+
+	if (bEnded) {
+		Playlist += TEXT("#EXT-X-ENDLIST\n");
+	}
+
+	const FString PlaylistFilename = FPaths::ChangeExtension(BaseFilename, TEXT("m3u8"));
+	if (!FFileHelper::SaveStringToFile(Playlist, *PlaylistFilename)) {
+		UE_LOG(LogFFmpeg, Warning, TEXT("Could not write the segment playlist '%s'."), *PlaylistFilename);
+	}
+}
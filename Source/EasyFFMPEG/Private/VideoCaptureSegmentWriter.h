@@ -0,0 +1,103 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "VideoCaptureStructures.h"
+#include "HAL/CriticalSection.h"
+#include "Async/Future.h"
+
+struct AVFormatContext;
+struct AVPacket;
+struct AVCodecParameters;
+class FVideoCaptureFileWriter;
+
+/**
+ * Rolling output: splits a capture into numbered files (Name_00000.mp4, Name_00001.mp4, ...) by duration and / or size.
+ * A new segment is only started on a video keyframe, so every file plays on its own, and the finished one gets its
+ * trailer written on a background thread while packets already go into the next. Optionally keeps an HLS style
+ * playlist (Name.m3u8) listing the finalized segments.
+ */
+class FVideoCaptureSegmentWriter
+{
+public:
+	FVideoCaptureSegmentWriter(const FString& InBaseFilename, const FCaptureConfigs& InCaptureConfigs);
+
+	~FVideoCaptureSegmentWriter();
+
+	/**
+	 * Copies the streams of TemplateCtx, which is never written itself, and opens the first segment.
+	 * Packets must come in the template's stream time bases.
+	 */
+	bool Open(const AVFormatContext* TemplateCtx);
+
+	/** Muxer thread. Takes over the packet's data (InPacket is left blank). */
+	void WritePacket(AVPacket* InPacket);
+
+	/** Finalizes the last segment, waits for every background finalize and ends the playlist. Returns false if any segment failed. */
+	bool Finish();
+
+private:
+	struct FStream
+	{
+		AVCodecParameters* Params = nullptr;
+		int32 TimeBaseNum = 0;
+		int32 TimeBaseDen = 1;
+		bool bIsVideo = false;
+	};
+
+	struct FSegment
+	{
+		AVFormatContext* FormatCtx = nullptr;
+		FVideoCaptureFileWriter* Writer = nullptr;
+		int32 Index = 0;
+
+		/** Timestamp of the first video packet, in the template video time base, INDEX_NONE until it is written. */
+		int64 StartPts = INDEX_NONE;
+		int64 EndPts = INDEX_NONE;
+
+		/** Subtracted from every packet so each file starts at 0, in AV_TIME_BASE. */
+		int64 TimestampOffset = 0;
+	};
+
+	struct FPlaylistEntry
+	{
+		FString Filename;
+		double Duration = 0.0;
+		bool bFinalized = false;
+		bool bSucceeded = false;
+	};
+
+	bool OpenSegment();
+
+	/** Hands the current segment to a background thread, which writes its trailer and closes the file. */
+	void FinalizeSegment();
+
+	static bool CloseSegment(FSegment& Segment);
+
+	/** Rewrites the playlist with every segment finalized so far, in order. Caller holds PlaylistLock. */
+	void WritePlaylist(bool bEnded);
+
+	FString GetSegmentFilename(int32 Index) const;
+
+	const FString BaseFilename;
+	const FCaptureConfigs CaptureConfigs;
+
+	TArray<FStream> Streams;
+	int32 VideoStreamIndex;
+
+	/** MPEG-TS segments keep the capture's timestamps, so the playlist plays them back to back. */
+	bool bContinuousTimestamps;
+
+	FSegment CurrentSegment;
+	int32 SegmentCount;
+
+	/** Packets dropped while no segment was open, over the whole capture and since the last segment failed to open. */
+	int64 DroppedPackets;
+	int64 PendingDroppedPackets;
+
+	TArray<TFuture<bool>> FinalizeTasks;
+
+	FCriticalSection PlaylistLock;
+	TArray<FPlaylistEntry> PlaylistEntries;
+};
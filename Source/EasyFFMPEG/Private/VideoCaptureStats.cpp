@@ -0,0 +1,43 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "VideoCaptureStats.h"
+#include "CaptureCore/CaptureVideoEncoder.h"
+
+UE_TRACE_CHANNEL_DEFINE(EasyFFMPEGChannel);
+
+DEFINE_STAT(STAT_EasyFFMPEG_StartCapture);
+DEFINE_STAT(STAT_EasyFFMPEG_StopCapture);
+DEFINE_STAT(STAT_EasyFFMPEG_ResolveRenderTarget);
+DEFINE_STAT(STAT_EasyFFMPEG_MapReadback);
+DEFINE_STAT(STAT_EasyFFMPEG_EncodeFrame);
+DEFINE_STAT(STAT_EasyFFMPEG_MuxPacket);
+DEFINE_STAT(STAT_EasyFFMPEG_FileWrite);
+DEFINE_STAT(STAT_EasyFFMPEG_AudioCallback);
+DEFINE_STAT(STAT_EasyFFMPEG_AudioEncode);
+
+DEFINE_STAT(STAT_EasyFFMPEG_HashMs);
+DEFINE_STAT(STAT_EasyFFMPEG_ConvertMs);
+DEFINE_STAT(STAT_EasyFFMPEG_CodecMs);
+DEFINE_STAT(STAT_EasyFFMPEG_PacketsMs);
+
+DEFINE_STAT(STAT_EasyFFMPEG_DroppedVideoFrames);
+DEFINE_STAT(STAT_EasyFFMPEG_DroppedAudioFrames);
+DEFINE_STAT(STAT_EasyFFMPEG_ElidedFrames);
+DEFINE_STAT(STAT_EasyFFMPEG_FileWriterStalls);
+DEFINE_STAT(STAT_EasyFFMPEG_MuxerOverflows);
+DEFINE_STAT(STAT_EasyFFMPEG_EncodeQueueDepth);
+
+DEFINE_STAT(STAT_EasyFFMPEG_ReadbackMemory);
+DEFINE_STAT(STAT_EasyFFMPEG_FrameBufferMemory);
+DEFINE_STAT(STAT_EasyFFMPEG_IOBufferMemory);
+DEFINE_STAT(STAT_EasyFFMPEG_ReplayBufferMemory);
+DEFINE_STAT(STAT_EasyFFMPEG_AudioBufferMemory);
+
+void VideoCaptureStats::AddFrameTiming(const FCaptureFrameTiming& Timing)
+{
+	INC_FLOAT_STAT_BY(STAT_EasyFFMPEG_HashMs, float(Timing.Hash * 1000.0));
+	INC_FLOAT_STAT_BY(STAT_EasyFFMPEG_ConvertMs, float(Timing.Convert * 1000.0));
+	INC_FLOAT_STAT_BY(STAT_EasyFFMPEG_CodecMs, float(Timing.Encode * 1000.0));
+	INC_FLOAT_STAT_BY(STAT_EasyFFMPEG_PacketsMs, float(Timing.Packets * 1000.0));
+}
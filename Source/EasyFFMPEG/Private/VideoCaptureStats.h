@@ -0,0 +1,58 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Stats/Stats.h"
+#include "Trace/Trace.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+
+/**
+ * Per stage counters of the capture pipeline, shown by `stat EasyFFMPEG`. The cycle counters are also emitted as CPU
+ * events on the EasyFFMPEG trace channel (-trace=cpu,EasyFFMPEG) for Unreal Insights. Everything here is only touched
+ * by code that runs while a capture is active, so an idle plugin costs nothing.
+ */
+DECLARE_STATS_GROUP(TEXT("EasyFFMPEG"), STATGROUP_EasyFFMPEG, STATCAT_Advanced);
+
+UE_TRACE_CHANNEL_EXTERN(EasyFFMPEGChannel);
+
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Start Capture"), STAT_EasyFFMPEG_StartCapture, STATGROUP_EasyFFMPEG, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Stop Capture"), STAT_EasyFFMPEG_StopCapture, STATGROUP_EasyFFMPEG, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Readback Resolve"), STAT_EasyFFMPEG_ResolveRenderTarget, STATGROUP_EasyFFMPEG, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Readback Map"), STAT_EasyFFMPEG_MapReadback, STATGROUP_EasyFFMPEG, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Encode Frame"), STAT_EasyFFMPEG_EncodeFrame, STATGROUP_EasyFFMPEG, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Mux Packet"), STAT_EasyFFMPEG_MuxPacket, STATGROUP_EasyFFMPEG, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("File Write"), STAT_EasyFFMPEG_FileWrite, STATGROUP_EasyFFMPEG, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Audio Submix Callback"), STAT_EasyFFMPEG_AudioCallback, STATGROUP_EasyFFMPEG, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Audio Encode"), STAT_EasyFFMPEG_AudioEncode, STATGROUP_EasyFFMPEG, );
+
+/** Encode Frame split up by the capture core, in ms per engine frame. */
+DECLARE_FLOAT_COUNTER_STAT_EXTERN(TEXT("Frame Hash (ms)"), STAT_EasyFFMPEG_HashMs, STATGROUP_EasyFFMPEG, );
+DECLARE_FLOAT_COUNTER_STAT_EXTERN(TEXT("Color Conversion (ms)"), STAT_EasyFFMPEG_ConvertMs, STATGROUP_EasyFFMPEG, );
+DECLARE_FLOAT_COUNTER_STAT_EXTERN(TEXT("Video Codec (ms)"), STAT_EasyFFMPEG_CodecMs, STATGROUP_EasyFFMPEG, );
+DECLARE_FLOAT_COUNTER_STAT_EXTERN(TEXT("Packet Output (ms)"), STAT_EasyFFMPEG_PacketsMs, STATGROUP_EasyFFMPEG, );
+
+/** Totals since StartCapture. */
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Dropped Video Frames"), STAT_EasyFFMPEG_DroppedVideoFrames, STATGROUP_EasyFFMPEG, );
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Dropped Audio Frames"), STAT_EasyFFMPEG_DroppedAudioFrames, STATGROUP_EasyFFMPEG, );
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Elided Frames"), STAT_EasyFFMPEG_ElidedFrames, STATGROUP_EasyFFMPEG, );
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("File Writer Stalls"), STAT_EasyFFMPEG_FileWriterStalls, STATGROUP_EasyFFMPEG, );
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Muxer Queue Overflows"), STAT_EasyFFMPEG_MuxerOverflows, STATGROUP_EasyFFMPEG, );
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Encode Queue Depth"), STAT_EasyFFMPEG_EncodeQueueDepth, STATGROUP_EasyFFMPEG, );
+
+DECLARE_MEMORY_STAT_EXTERN(TEXT("Readback Textures"), STAT_EasyFFMPEG_ReadbackMemory, STATGROUP_EasyFFMPEG, );
+DECLARE_MEMORY_STAT_EXTERN(TEXT("Captured Frame Buffers"), STAT_EasyFFMPEG_FrameBufferMemory, STATGROUP_EasyFFMPEG, );
+DECLARE_MEMORY_STAT_EXTERN(TEXT("File IO Buffers"), STAT_EasyFFMPEG_IOBufferMemory, STATGROUP_EasyFFMPEG, );
+DECLARE_MEMORY_STAT_EXTERN(TEXT("Replay Buffer"), STAT_EasyFFMPEG_ReplayBufferMemory, STATGROUP_EasyFFMPEG, );
+DECLARE_MEMORY_STAT_EXTERN(TEXT("Audio Ring Buffers"), STAT_EasyFFMPEG_AudioBufferMemory, STATGROUP_EasyFFMPEG, );
+
+/** SCOPE_CYCLE_COUNTER that also shows up as a CPU event on the EasyFFMPEG trace channel. */
+#define EASYFFMPEG_SCOPE_CYCLE_COUNTER(Stat) \
+	SCOPE_CYCLE_COUNTER(Stat); \
+	TRACE_CPUPROFILER_EVENT_SCOPE_ON_CHANNEL(Stat, EasyFFMPEGChannel)
+
+namespace VideoCaptureStats
+{
+	/** Adds the stage times of the frame FCaptureVideoEncoder::EncodeBGRA() just encoded to the float counters. */
+	void AddFrameTiming(const struct FCaptureFrameTiming& Timing);
+}
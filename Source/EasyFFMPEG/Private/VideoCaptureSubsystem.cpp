@@ -2,10 +2,21 @@
 
 
 #include "VideoCaptureSubsystem.h"
+#include "VideoColorConversion.h"
+#include "VideoEncoderOptions.h"
+#include "CaptureCore/CaptureVideoEncoder.h"
+#include "VideoCaptureFileWriter.h"
+#include "VideoCaptureEncoderThread.h"
+#include "VideoCaptureMuxerThread.h"
+#include "VideoCaptureAudioEncoderThread.h"
+#include "VideoCaptureReplayBuffer.h"
+#include "VideoCaptureSegmentWriter.h"
+#include "VideoEncoderGovernor.h"
+#include "AudioSampleConversion.h"
+#include "VideoCaptureStats.h"
 
 #include "Slate/SceneViewport.h"
 #include "Engine/GameEngine.h"
-#include "HAL/FileManager.h"
 
 #include "RHIStaticStates.h"
 #include "Shader.h"
@@ -14,18 +25,19 @@
 #include "PipelineStateCache.h"
 #include "CommonRenderResources.h"
 #include "RenderTargetPool.h"
-#include "RenderCommandFence.h"
 
 #include "Kismet/GameplayStatics.h"
+#include "Async/Async.h"
+#include "Misc/App.h"
+#include "Containers/Ticker.h"
+#include "Misc/ScopeExit.h"
 
 extern "C" {
 #include "libavcodec/avcodec.h"
 #include "libavutil/opt.h"
 #include "libavformat/avformat.h"
-#include "libavutil/imgutils.h"
-#include "libswscale/swscale.h"
 #include "libavutil/error.h"
-#include <libswresample/swresample.h>
+#include "libswresample/swresample.h"
 }
 
 #if WITH_EDITOR
@@ -38,53 +50,162 @@ DECLARE_LOG_CATEGORY_CLASS(LogVideoCaptureSubsystem, Log, All);
 
 void UVideoCaptureSubsystem::Deinitialize()
 {
+	// Nothing ticks PollCaptureStart() anymore, finish a pending start here so it is torn down below.
+	if (StartTask.IsValid()) {
+		FTicker::GetCoreTicker().RemoveTicker(StartTickerHandle);
+		StartTask.Wait();
+
+		bCancelStart = true;
+		PollCaptureStart(0.f);
+	}
+
 	StopCapture();
+	WaitForFinalize();
 
 	Super::Deinitialize();
 }
 
 void UVideoCaptureSubsystem::OnNewSubmixBuffer(const USoundSubmix* OwningSubmix, float* AudioData, int32 NumSamples, int32 NumChannels, const int32 SampleRate, double AudioClock)
 {
-	Audio::AlignedFloatBuffer InData;
-	InData.Append(AudioData, NumSamples);
-	Audio::TSampleBuffer<float> FloatBuffer(InData, NumChannels, SampleRate);
+	EASYFFMPEG_SCOPE_CYCLE_COUNTER(STAT_EasyFFMPEG_AudioCallback);
 
-	if (FloatBuffer.GetNumChannels() != 2)
+	// Unregistering is queued to the audio thread, so this can still be called after StopCapture.
+	// The counter goes up before the flag is read so WaitForAudioCallbacks can't miss a callback that passed the check.
+	AudioCallbacksInFlight.Increment();
+	ON_SCOPE_EXIT
 	{
-		FloatBuffer.MixBufferToChannels(2);
+		AudioCallbacksInFlight.Decrement();
+	};
+	if (!bAudioAttached || AudioEncoderThread == nullptr) {
+		return;
 	}
-	FloatBuffer.Clamp();
 
-	Audio::TSampleBuffer<int16> PCMData;
-	PCMData = FloatBuffer;
+	const uint64 StartCycles = FPlatformTime::Cycles64();
 
-	AudioSubmixBuffer.Append(reinterpret_cast<const uint8*>(PCMData.GetData()), PCMData.GetNumSamples() * sizeof(*PCMData.GetData()));
+	const int32 NumFrames = NumSamples / NumChannels;
 
-	int32 FrameBytes = AudioTempFrame->nb_samples * AudioCodecCtx->channels * 2;
+	// The buffer's first sample was due one buffer length ago.
+	if (AudioStartCycles.GetValue() == 0) {
+		const double BufferSeconds = double(NumFrames) / SampleRate;
+		AudioStartCycles.Set(int64(StartCycles - uint64(BufferSeconds / FPlatformTime::GetSecondsPerCycle64())));
+	}
 
-	if (AudioSubmixBuffer.Num() < FrameBytes) {
-		return;
+	// Deinterleave straight into the ring, in two passes when the write position wraps around.
+	int32 WrittenFrames = 0;
+	while (WrittenFrames < NumFrames)
+	{
+		float* Planes[AudioEncoderChannels];
+		const int32 SpanFrames = FMath::Min(AudioRingBuffer.GetWriteSpans(Planes), NumFrames - WrittenFrames);
+		if (SpanFrames == 0) {
+			AudioDroppedFrames.Add(NumFrames - WrittenFrames);
+			INC_DWORD_STAT_BY(STAT_EasyFFMPEG_DroppedAudioFrames, NumFrames - WrittenFrames);
+			break;
+		}
+
+		AudioSampleConversion::DeinterleaveToPlanar(AudioData + WrittenFrames * NumChannels, SpanFrames, NumChannels, Planes, AudioEncoderChannels);
+
+		// Both channels at once, the encoder thread never sees one ahead of the other.
+		AudioRingBuffer.Commit(SpanFrames);
+		WrittenFrames += SpanFrames;
 	}
 
-	FMemory::Memcpy(AudioTempFrame->data[0], AudioSubmixBuffer.GetData(), FrameBytes);
+	AudioEncoderThread->Notify();
 
-	AudioSubmixBuffer.RemoveAt(0, FrameBytes);
+	// Only the audio thread writes these, the counters just make the reads from other threads safe.
+	const int64 ElapsedCycles = int64(FPlatformTime::Cycles64() - StartCycles);
+	AudioCallbackCount.Increment();
+	AudioCallbackCycles.Add(ElapsedCycles);
+	if (ElapsedCycles > AudioCallbackMaxCycles.GetValue()) {
+		AudioCallbackMaxCycles.Set(ElapsedCycles);
+	}
+}
+
+void UVideoCaptureSubsystem::WaitForAudioCallbacks()
+{
+	check(!bAudioAttached);
+	while (AudioCallbacksInFlight.GetValue() > 0)
+	{
+		FPlatformProcess::SleepNoStats(0.0001f);
+	}
+}
 
-	int32 DST_NB_Samples = av_rescale_rnd(swr_get_delay(AudioSwrCtx, AudioCodecCtx->sample_rate) + AudioTempFrame->nb_samples,
-		AudioCodecCtx->sample_rate, AudioCodecCtx->sample_rate, AV_ROUND_UP);
+void UVideoCaptureSubsystem::EncodePendingAudio()
+{
+	EASYFFMPEG_SCOPE_CYCLE_COUNTER(STAT_EasyFFMPEG_AudioEncode);
 
-	if (av_frame_make_writable(AudioFrame) < 0) {
-		UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Cloud not make dst frame writable."));
-		return;
+	while (true)
+	{
+		if (AudioFrameFill == 0 && av_frame_make_writable(AudioFrame) < 0) {
+			UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Cloud not make dst frame writable."));
+			return;
+		}
+
+		const int32 MissingFrames = AudioFrame->nb_samples - AudioFrameFill;
+		uint8* Planes[AudioEncoderChannels];
+		for (int32 Channel = 0; Channel < AudioEncoderChannels; Channel++)
+		{
+			Planes[Channel] = AudioFrame->data[Channel] + AudioFrameFill * sizeof(float);
+		}
+
+		int32 FilledFrames = 0;
+		if (AudioSwrCtx != nullptr) {
+			QueuePendingAudioForResampling();
+
+			// swr keeps whatever does not fit into this frame for the next one. Input must not be null, that would flush the resampler.
+			FilledFrames = swr_convert(AudioSwrCtx, Planes, MissingFrames, const_cast<const uint8**>(AudioResampleFrame->data), 0);
+			if (FilledFrames < 0) {
+				UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Cloud not resample the submix audio."));
+				return;
+			}
+		}
+		else {
+			FilledFrames = FMath::Min(AudioRingBuffer.Num(), MissingFrames);
+			if (!AudioRingBuffer.Pop(reinterpret_cast<float* const*>(Planes), FilledFrames)) {
+				FilledFrames = 0;
+			}
+		}
+
+		if (FilledFrames == 0) {
+			return;
+		}
+
+		AudioFrameFill += FilledFrames;
+		if (AudioFrameFill == AudioFrame->nb_samples) {
+			EncodeAudioFrame();
+			AudioFrameFill = 0;
+		}
 	}
+}
 
-	if (swr_convert(AudioSwrCtx, AudioFrame->data, DST_NB_Samples, (const uint8**)AudioTempFrame->data, AudioTempFrame->nb_samples) < 0) {
-		UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Cloud not convert source frame to dst frame."));
-		return;
+void UVideoCaptureSubsystem::QueuePendingAudioForResampling()
+{
+	while (AudioRingBuffer.Num() > 0)
+	{
+		const int32 NumFrames = FMath::Min(AudioRingBuffer.Num(), AudioResampleFrame->nb_samples);
+		if (!AudioRingBuffer.Pop(reinterpret_cast<float* const*>(AudioResampleFrame->data), NumFrames)) {
+			return;
+		}
+
+		if (swr_convert(AudioSwrCtx, nullptr, 0, const_cast<const uint8**>(AudioResampleFrame->data), NumFrames) < 0) {
+			UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Cloud not resample the submix audio."));
+			return;
+		}
+	}
+}
+
+void UVideoCaptureSubsystem::EncodeAudioFrame()
+{
+	// Variable frame rate video is stamped on the capture clock, start the audio where its first buffer was on the same clock.
+	if (bAlignAudioClock) {
+		const int64 StartCycles = AudioStartCycles.GetValue();
+		if (StartCycles > int64(CaptureStartCycles)) {
+			AudioSampleCount += FMath::RoundToInt(FPlatformTime::ToSeconds64(StartCycles - CaptureStartCycles) * AudioCodecCtx->sample_rate);
+		}
+		bAlignAudioClock = false;
 	}
 
 	AudioFrame->pts = av_rescale_q(AudioSampleCount, { 1, AudioCodecCtx->sample_rate }, AudioCodecCtx->time_base);
-	AudioSampleCount += DST_NB_Samples;
+	AudioSampleCount += AudioFrame->nb_samples;
 	//AudioStream.NextPts++;
 
 	int32 Result = avcodec_send_frame(AudioCodecCtx, AudioFrame);
@@ -112,29 +233,40 @@ void UVideoCaptureSubsystem::OnNewSubmixBuffer(const USoundSubmix* OwningSubmix,
 		av_packet_rescale_ts(&AudioPacket, AudioCodecCtx->time_base, AudioStream->time_base);
 		AudioPacket.stream_index = AudioStream->index;
 
-		av_interleaved_write_frame(FormatCtx, &AudioPacket);
-
-		av_packet_unref(&AudioPacket);
+		SubmitPacket(&AudioPacket);
 	}
 }
 
 void UVideoCaptureSubsystem::StartCapture(const FString& InVideoFilename, const FCaptureConfigs& InConfigs)
 {
+	EASYFFMPEG_SCOPE_CYCLE_COUNTER(STAT_EasyFFMPEG_StartCapture);
+
+	// The previous capture has to be written out before its pipeline can be reused.
+	WaitForFinalize();
+
+	if (CaptureState != EMovieCaptureState::NotInit) {
+		UE_LOG(LogVideoCaptureSubsystem, Warning, TEXT("Please uninitialize capture component before call InitCapture()."));
+		return;
+	}
+
 	AudioSampleCount = 0;
+	AudioSubmixSampleRate = 0;
 	CapturedFrameNumber = 0;
+	ElidedFrameCount = 0;
+	DroppedFrameCount = 0;
 	CaptureConfigs = InConfigs;
 
+	if (CaptureConfigs.bFixedTimestep && CaptureConfigs.bVariableFrameRate) {
+		UE_LOG(LogVideoCaptureSubsystem, Warning, TEXT("bVariableFrameRate is ignored by fixed timestep captures."));
+		CaptureConfigs.bVariableFrameRate = false;
+	}
+
 	APlayerController* PC = UGameplayStatics::GetPlayerController(this, 0);
 	if (PC == nullptr) {
 		UE_LOG(LogVideoCaptureSubsystem, Warning, TEXT("Can not found player controller."));
 		return;
 	}
 
-	if (IsInitialized()) {
-		UE_LOG(LogVideoCaptureSubsystem, Warning, TEXT("Please uninitialize capture component before call InitCapture()."));
-		return;
-	}
-
 	PC->GetViewportSize(ViewportSize.X, ViewportSize.Y);
 
 	if (!FindViewportWindow()) {
@@ -142,203 +274,205 @@ void UVideoCaptureSubsystem::StartCapture(const FString& InVideoFilename, const
 		return;
 	}
 
-	if (!InitReadbackTexture())
-	{
-		UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Failed to create the readback texture."));
-		return;
-	}
-
 	VideoFilename = InVideoFilename;
 
-	if (!CreateVideoFileWriter()) {
-		UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Cant create the video file '%s'."), *VideoFilename);
-		StopCapture();
-		return;
+	if (CaptureConfigs.bReplayBuffer && CaptureConfigs.bSegmentedOutput) {
+		UE_LOG(LogVideoCaptureSubsystem, Warning, TEXT("bSegmentedOutput is ignored by replay captures."));
+		CaptureConfigs.bSegmentedOutput = false;
 	}
 
-	DestroyVideoFileWriter();
-
-	int32 result = avformat_alloc_output_context2(&FormatCtx, nullptr, nullptr, TCHAR_TO_UTF8(*VideoFilename));
-	if (result < 0) {
-		UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Can not allocate format context."));
-		StopCapture();
-		return;
+	// The submix runs at the audio device rate, the device is only safe to ask from here.
+	FAudioDevice* AudioDevice = GEngine->GetActiveAudioDevice().GetAudioDevice();
+	if (AudioDevice != nullptr) {
+		AudioSubmixSampleRate = FMath::RoundToInt(AudioDevice->GetSampleRate());
 	}
 
-	Codec = avcodec_find_encoder(FormatCtx->oformat->video_codec);
-	if (Codec == nullptr) {
-		UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Codec not found."));
-		StopCapture();
-		return;
-	}
+	AudioCallbackCount.Reset();
+	AudioCallbackCycles.Reset();
+	AudioCallbackMaxCycles.Reset();
+	AudioDroppedFrames.Reset();
 
-	Stream = avformat_new_stream(FormatCtx, Codec);
-	if (Stream == nullptr) {
-		UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Can not allocate a new stream."));
-		StopCapture();
-		return;
-	}
+	Telemetry.Reset();
 
-	CodecCtx = avcodec_alloc_context3(Codec);
-	if (Codec == nullptr) {
-		UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("InitCapture() failed: Cloud not allocate video codec context."));
-		StopCapture();
-		return;
-	}
+	SET_DWORD_STAT(STAT_EasyFFMPEG_DroppedVideoFrames, 0);
+	SET_DWORD_STAT(STAT_EasyFFMPEG_DroppedAudioFrames, 0);
+	SET_DWORD_STAT(STAT_EasyFFMPEG_ElidedFrames, 0);
+	SET_DWORD_STAT(STAT_EasyFFMPEG_EncodeQueueDepth, 0);
+	SET_DWORD_STAT(STAT_EasyFFMPEG_MuxerOverflows, 0);
+
+	// Everything slow (textures, file, codecs, header, threads) is built off the game thread, BeginCapturing() hooks the
+	// back buffer once it is ready. Frames presented until then are not part of the recording.
+	TFuture<bool> ReadbackTexturesCreated = InitReadbackTextures();
+	const FCaptureVideoSettings VideoSettings = VideoEncoderOptions::MakeVideoSettings(CaptureConfigs, ViewportSize);
+
+	UVideoCaptureSubsystem* This = this;
 
-	Stream->codecpar->codec_id = FormatCtx->oformat->video_codec;
-	Stream->codecpar->codec_type = AVMEDIA_TYPE_VIDEO;
-	Stream->codecpar->width = ViewportSize.X;
-	Stream->codecpar->height = ViewportSize.Y;
-	Stream->codecpar->format = AV_PIX_FMT_YUV420P;
-	Stream->codecpar->bit_rate = CaptureConfigs.BitRate * 1000;
+	StartRequestTime = FPlatformTime::Seconds();
+	bCancelStart = false;
+	CaptureState = EMovieCaptureState::Starting;
+
+	StartTask = Async(EAsyncExecution::Thread, [This, VideoSettings, ReadbackTexturesCreated = MoveTemp(ReadbackTexturesCreated)]() mutable
+	{
+		const bool bOpened = This->OpenPipeline(VideoSettings);
+
+		if (!ReadbackTexturesCreated.Get()) {
+			UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Failed to create the readback textures."));
+			return false;
+		}
 
-	avcodec_parameters_to_context(CodecCtx, Stream->codecpar);
+		return bOpened;
+	});
 
-	CodecCtx->time_base = { CaptureConfigs.FrameRate.Y, CaptureConfigs.FrameRate.X };
-	CodecCtx->framerate = { CaptureConfigs.FrameRate.X, CaptureConfigs.FrameRate.Y };
-	CodecCtx->gop_size = CaptureConfigs.GopSize;
-	CodecCtx->max_b_frames = CaptureConfigs.MaxBFrames;
+	StartTickerHandle = FTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateUObject(this, &UVideoCaptureSubsystem::PollCaptureStart));
+}
 
-	if (Stream->codecpar->codec_id == AV_CODEC_ID_H264) {
-		av_opt_set(CodecCtx, "preset", "slow", 0);
+bool UVideoCaptureSubsystem::OpenPipeline(const FCaptureVideoSettings& VideoSettings)
+{
+	// Replay and segmented captures open their files later on.
+	const bool bSingleFile = !CaptureConfigs.bReplayBuffer && !CaptureConfigs.bSegmentedOutput;
+	if (bSingleFile && !CreateVideoFileWriter()) {
+		UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Cant create the video file '%s'."), *VideoFilename);
+		return false;
 	}
 
-	result = avcodec_open2(CodecCtx, Codec, nullptr);
+	int32 result = avformat_alloc_output_context2(&FormatCtx, nullptr, nullptr, TCHAR_TO_UTF8(*VideoFilename));
 	if (result < 0) {
-		UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Could not open codec."));
-		StopCapture();
-		return;
+		UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Can not allocate format context."));
+		return false;
 	}
 
-	avcodec_parameters_from_context(Stream->codecpar, CodecCtx);
+	UVideoCaptureSubsystem* This = this;
 
-	AudioCodec = avcodec_find_encoder(FormatCtx->oformat->audio_codec);
-	if (AudioCodec == nullptr) {
-		UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Codec not found."));
-		StopCapture();
-		return;
+	VideoEncoder = new FCaptureVideoEncoder();
+	const bool bEncoderOpened = VideoEncoder->Open(FormatCtx->oformat, VideoSettings,
+		[This](AVPacket* InPacket) { This->OnVideoPacket(InPacket); },
+		VideoColorConversion::GetParallelFor());
+	if (!bEncoderOpened) {
+		UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Could not open codec."));
+		return false;
 	}
 
-	AudioStream = avformat_new_stream(FormatCtx, AudioCodec);
-	if (AudioStream == nullptr) {
+	Stream = avformat_new_stream(FormatCtx, nullptr);
+	if (Stream == nullptr) {
 		UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Can not allocate a new stream."));
-		StopCapture();
-		return;
+		return false;
 	}
 
-	AudioStream->id = FormatCtx->nb_streams - 1;
-
-	AudioCodecCtx = avcodec_alloc_context3(AudioCodec);
-	if (AudioCodec == nullptr) {
-		UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("InitCapture() failed: Cloud not allocate audio codec context."));
-		StopCapture();
-		return;
-	}
+	avcodec_parameters_from_context(Stream->codecpar, VideoEncoder->GetCodecContext());
 
-	AudioCodecCtx->sample_fmt = AV_SAMPLE_FMT_FLTP;
-	AudioCodecCtx->bit_rate = 196608;
-	AudioCodecCtx->sample_rate = 48000;
-	AudioCodecCtx->channel_layout = AV_CH_LAYOUT_STEREO;
-	AudioCodecCtx->channels = av_get_channel_layout_nb_channels(AudioCodecCtx->channel_layout);
+	UE_LOG(LogVideoCaptureSubsystem, Log, TEXT("Converting captured frames with the %s kernel."), UTF8_TO_TCHAR(VideoEncoder->GetConversionName()));
 
-	if (FormatCtx->oformat->flags & AVFMT_GLOBALHEADER) {
-		AudioCodecCtx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+	// The submix is mixed in real time, it would not line up with frames rendered on a fixed timestep.
+	if (CaptureConfigs.bFixedTimestep) {
+		UE_LOG(LogVideoCaptureSubsystem, Log, TEXT("Fixed timestep capture, the audio is not recorded."));
+	}
+	else if (!InitAudioEncoder()) {
+		return false;
 	}
 
-	avcodec_parameters_from_context(AudioStream->codecpar, AudioCodecCtx);
-
-	AudioStream->time_base = { 1, AudioCodecCtx->sample_rate };
+	av_dump_format(FormatCtx, 0, TCHAR_TO_UTF8(*VideoFilename), 1);
 
-	if (avcodec_open2(AudioCodecCtx, AudioCodec, nullptr) < 0) {
-		UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Cloud not open audio codec."));
-		StopCapture();
-		return;
+	if (!bSingleFile) {
+		// Without a header the streams keep the time bases the packets are rescaled into.
+		Stream->time_base = VideoEncoder->GetCodecContext()->time_base;
 	}
 
-	int32 SamplesCount = 0;
-	if (AudioCodecCtx->codec->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE) {
-		SamplesCount = 10000;
+	if (CaptureConfigs.bReplayBuffer) {
+		ReplayBuffer = new FVideoCaptureReplayBuffer(CaptureConfigs.ReplayDuration, int64(CaptureConfigs.ReplayMaxMemoryMB) * 1024 * 1024);
+		for (uint32 Index = 0; Index < FormatCtx->nb_streams; Index++)
+		{
+			const AVStream* ReplayStream = FormatCtx->streams[Index];
+			ReplayBuffer->AddStream(ReplayStream->codecpar, ReplayStream->time_base.num, ReplayStream->time_base.den);
+		}
 	}
-	else {
-		SamplesCount = AudioCodecCtx->frame_size;
+	else if (CaptureConfigs.bSegmentedOutput) {
+		SegmentWriter = new FVideoCaptureSegmentWriter(VideoFilename, CaptureConfigs);
+		if (!SegmentWriter->Open(FormatCtx)) {
+			UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Cant create the first segment of '%s'."), *VideoFilename);
+			return false;
+		}
 	}
+	else {
+		FormatCtx->pb = Writer->GetIOContext();
+		FormatCtx->flags |= AVFMT_FLAG_CUSTOM_IO;
 
-	AudioFrame = AllocAudioFrame(AudioCodecCtx->sample_fmt, AudioCodecCtx->channel_layout, AudioCodecCtx->sample_rate, SamplesCount);
-	AudioTempFrame = AllocAudioFrame(AV_SAMPLE_FMT_S16, AudioCodecCtx->channel_layout, AudioCodecCtx->sample_rate, SamplesCount);
+		AVDictionary* MuxerOptions = nullptr;
+		VideoEncoderOptions::ApplyMuxer(FormatCtx->oformat, CaptureConfigs, &MuxerOptions);
 
-	if (avcodec_parameters_from_context(AudioStream->codecpar, AudioCodecCtx) < 0) {
-		UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Cloud not copy the stream parameters."));
-		StopCapture();
-		return;
+		result = avformat_write_header(FormatCtx, &MuxerOptions);
+		VideoEncoderOptions::ReportUnusedAndFree(&MuxerOptions);
+		if (result < 0) {
+			UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Error ocurred when write header into file."));
+			return false;
+		}
 	}
 
-	AudioSwrCtx = swr_alloc();
-	if (AudioSwrCtx == nullptr) {
-		UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Cloud not allocate resampler context."));
-		StopCapture();
-		return;
+	if (ReplayBuffer == nullptr) {
+		MuxerThread = SegmentWriter != nullptr ? new FVideoCaptureMuxerThread(SegmentWriter) : new FVideoCaptureMuxerThread(FormatCtx);
+		if (!MuxerThread->Start()) {
+			UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Cloud not start the muxer thread."));
+			return false;
+		}
 	}
 
-	av_opt_set_int(AudioSwrCtx, "in_channel_count", AudioCodecCtx->channels, 0);
-	av_opt_set_int(AudioSwrCtx, "in_sample_rate", AudioCodecCtx->sample_rate, 0);
-	av_opt_set_int(AudioSwrCtx, "in_sample_fmt", AV_SAMPLE_FMT_S16, 0);
-	av_opt_set_int(AudioSwrCtx, "out_channel_count", AudioCodecCtx->channels, 0);
-	av_opt_set_int(AudioSwrCtx, "out_sample_rate", AudioCodecCtx->sample_rate, 0);
-	av_opt_set_int(AudioSwrCtx, "out_sample_fmt", AudioCodecCtx->sample_fmt, 0);
+	if (!StartEncoderThread()) {
+		UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Cloud not start the encoder thread."));
+		return false;
+	}
 
-	if (swr_init(AudioSwrCtx) < 0) {
-		UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Failed to initialize the resampling context."));
-		StopCapture();
-		return;
+	if (AudioCodecCtx != nullptr) {
+		AudioEncoderThread = new FVideoCaptureAudioEncoderThread([This]() { This->EncodePendingAudio(); });
+		if (!AudioEncoderThread->Start()) {
+			UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Cloud not start the audio encoder thread."));
+			return false;
+		}
 	}
 
-	av_dump_format(FormatCtx, 0, TCHAR_TO_UTF8(*VideoFilename), 1);
+	return true;
+}
 
-	result = avio_open(&FormatCtx->pb, TCHAR_TO_UTF8(*VideoFilename), AVIO_FLAG_WRITE);
-	if (result < 0) {
-		UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Cant open the file '%s'."), *VideoFilename);
-		StopCapture();
-		return;
+bool UVideoCaptureSubsystem::PollCaptureStart(float DeltaTime)
+{
+	if (!StartTask.IsReady()) {
+		return true;
 	}
 
-	result = avformat_write_header(FormatCtx, nullptr);
-	if (result < 0) {
-		UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Error ocurred when write header into file."));
-		StopCapture();
-		return;
-	}
+	// Returning false removes this ticker.
+	StartTickerHandle.Reset();
 
-	Packet = av_packet_alloc();
-	if (Packet == nullptr) {
-		UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("InitCapture() failed: Cloud not allocate packet."));
-		StopCapture();
-		return;
-	}
+	const bool bStarted = StartTask.Get();
+	StartTask.Reset();
 
-	Frame = av_frame_alloc();
-	if (Frame == nullptr) {
-		UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Cloud not allocate video frame."));
+	// Whatever the background start has built is torn down like a running capture.
+	if (!bStarted || bCancelStart) {
+		bCancelStart = false;
 		StopCapture();
-		return;
+		return false;
 	}
 
-	Frame->format = CodecCtx->pix_fmt;
-	Frame->width = CodecCtx->width;
-	Frame->height = CodecCtx->height;
+	BeginCapturing();
 
-	result = av_frame_get_buffer(Frame, 0);
-	if (result < 0) {
-		UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Cloud not allocate the video frame data."));
-		StopCapture();
-		return;
+	UE_LOG(LogVideoCaptureSubsystem, Log, TEXT("Capturing into '%s', the pipeline took %.1f ms to start."), *VideoFilename, (FPlatformTime::Seconds() - StartRequestTime) * 1000.0);
+
+	OnCaptureStarted.Broadcast(VideoFilename, true);
+	return false;
+}
+
+void UVideoCaptureSubsystem::BeginCapturing()
+{
+	if (CaptureConfigs.bFixedTimestep) {
+		ApplyFixedTimestep();
 	}
 
 	int64 timeBase = CaptureConfigs.FrameRate.Y * 1000000000;
 	CaptureFrameInterval = std::chrono::nanoseconds(timeBase / CaptureConfigs.FrameRate.X);
 	PreFrameCaptureTime = std::chrono::steady_clock::now();
 
-	AvailableEvent = nullptr;
+	// Both the first back buffer and the first submix buffer are placed relative to this.
+	CaptureStartCycles = FPlatformTime::Cycles64();
+	AudioStartCycles.Reset();
+	bAlignAudioClock = CaptureConfigs.bVariableFrameRate;
+	LastVideoPts = -1;
 
 	if (FSlateApplication::IsInitialized())
 	{
@@ -346,71 +480,313 @@ void UVideoCaptureSubsystem::StartCapture(const FString& InVideoFilename, const
 	}
 
 	FAudioDevice* AudioDevice = GEngine->GetActiveAudioDevice().GetAudioDevice();
-	if (AudioDevice) {
+	if (AudioDevice && AudioEncoderThread != nullptr) {
+		bAudioAttached = true;
 		AudioDevice->RegisterSubmixBufferListener(this);
 	}
 
+	if (CaptureConfigs.StatsInterval > 0.f) {
+		StatsTickerHandle = FTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateUObject(this, &UVideoCaptureSubsystem::BroadcastCaptureStats), CaptureConfigs.StatsInterval);
+	}
+
 	CaptureState = EMovieCaptureState::Initialized;
 }
 
+void UVideoCaptureSubsystem::ApplyFixedTimestep()
+{
+	if (!bFixedTimestepApplied) {
+		bSavedUseFixedTimeStep = FApp::UseFixedTimeStep();
+		SavedFixedDeltaTime = FApp::GetFixedDeltaTime();
+		bFixedTimestepApplied = true;
+	}
+
+	// Every engine frame now advances the game by exactly one video frame, however long it takes to render and encode.
+	FApp::SetUseFixedTimeStep(true);
+	FApp::SetFixedDeltaTime(double(CaptureConfigs.FrameRate.Y) / CaptureConfigs.FrameRate.X);
+}
+
+void UVideoCaptureSubsystem::RestoreFixedTimestep()
+{
+	if (!bFixedTimestepApplied) {
+		return;
+	}
+
+	FApp::SetUseFixedTimeStep(bSavedUseFixedTimeStep);
+	FApp::SetFixedDeltaTime(SavedFixedDeltaTime);
+	bFixedTimestepApplied = false;
+}
+
 bool UVideoCaptureSubsystem::IsInitialized()
 {
-	return CaptureState >= EMovieCaptureState::Initialized;
+	return CaptureState == EMovieCaptureState::Initialized || CaptureState == EMovieCaptureState::Capturing;
+}
+
+bool UVideoCaptureSubsystem::IsPipelineInBackground() const
+{
+	return CaptureState == EMovieCaptureState::Starting || CaptureState == EMovieCaptureState::Stopping;
 }
 
 void UVideoCaptureSubsystem::StopCapture()
 {
+	EASYFFMPEG_SCOPE_CYCLE_COUNTER(STAT_EasyFFMPEG_StopCapture);
+
+	if (CaptureState == EMovieCaptureState::NotInit || CaptureState == EMovieCaptureState::Stopping) {
+		return;
+	}
+
+	// The background start can not be interrupted, PollCaptureStart() stops the capture as soon as it is done.
+	if (StartTask.IsValid()) {
+		bCancelStart = true;
+		return;
+	}
+
+	const bool bWasStarting = CaptureState == EMovieCaptureState::Starting;
+
 	if (FSlateApplication::IsInitialized())
 	{
 		FSlateApplication::Get().GetRenderer()->OnBackBufferReadyToPresent().Remove(BackBufferHandle);
 	}
 
+	bAudioAttached = false;
 	FAudioDevice* AudioDevice = GEngine->GetActiveAudioDevice().GetAudioDevice();
 	if (AudioDevice) {
 		AudioDevice->UnregisterSubmixBufferListener(this);
 	}
 
-	BlockUntilAvailable();
+	if (StatsTickerHandle.IsValid()) {
+		FTicker::GetCoreTicker().RemoveTicker(StatsTickerHandle);
+		StatsTickerHandle.Reset();
+	}
+
+	RestoreFixedTimestep();
+
+	// Frames already copied on the GPU are still recorded, nothing new can arrive now. The finalize waits for the render
+	// thread to hand them over, the game thread does not.
+	TFuture<void> ReadbacksFlushed = FlushPendingReadbacks();
 
 	ViewportWindow = nullptr;
-	ReadbackTexture.SafeRelease();
-	ReadbackTexture = nullptr;
 
-	DestroyVideoFileWriter();
-	ReleaseContext();
+	// Draining the encoder (B-frames, lookahead), the trailer and the teardown all happen in the background.
+	bBroadcastFinalize = !bWasStarting;
+	StopRequestTime = FPlatformTime::Seconds();
+	CaptureState = EMovieCaptureState::Stopping;
+
+	UVideoCaptureSubsystem* This = this;
+	FinalizeTask = Async(EAsyncExecution::Thread, [This, ReadbacksFlushed = MoveTemp(ReadbacksFlushed)]()
+	{
+		ReadbacksFlushed.Wait();
+		return This->FinalizePipeline();
+	});
+
+	FinalizeTickerHandle = FTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateUObject(this, &UVideoCaptureSubsystem::PollCaptureFinalize));
+
+	if (bWasStarting) {
+		OnCaptureStarted.Broadcast(VideoFilename, false);
+	}
+}
+
+bool UVideoCaptureSubsystem::FinalizePipeline()
+{
+	StopEncoderThread();
+	WaitForAudioCallbacks();
+	StopAudioEncoderThread();
 
-	AudioSubmixBuffer.Empty();
+	bool bSucceeded = ReleaseContext();
+	bSucceeded &= DestroyVideoFileWriter();
+	DestroyReplayBuffer();
+
+	return bSucceeded;
+}
+
+bool UVideoCaptureSubsystem::PollCaptureFinalize(float DeltaTime)
+{
+	if (!FinalizeTask.IsReady()) {
+		return true;
+	}
+
+	// Returning false removes this ticker.
+	FinalizeTickerHandle.Reset();
+
+	FinishFinalize();
+	return false;
+}
+
+void UVideoCaptureSubsystem::WaitForFinalize()
+{
+	if (!FinalizeTask.IsValid()) {
+		return;
+	}
+
+	FinalizeTask.Wait();
+
+	if (FinalizeTickerHandle.IsValid()) {
+		FTicker::GetCoreTicker().RemoveTicker(FinalizeTickerHandle);
+		FinalizeTickerHandle.Reset();
+	}
+
+	FinishFinalize();
+}
+
+void UVideoCaptureSubsystem::FinishFinalize()
+{
+	const bool bSucceeded = FinalizeTask.Get();
+	FinalizeTask.Reset();
+
+	// The encoder thread is gone, so are its reads of the mapped surfaces.
+	ReleaseReadbackTextures();
+
+	AudioRingBuffer.Release();
+	SET_MEMORY_STAT(STAT_EasyFFMPEG_AudioBufferMemory, 0);
+
+	CaptureState = EMovieCaptureState::NotInit;
+
+	if (!bBroadcastFinalize) {
+		return;
+	}
+
+	UE_LOG(LogVideoCaptureSubsystem, Log, TEXT("Finalized '%s' %.1f ms after StopCapture()."), *VideoFilename, (FPlatformTime::Seconds() - StopRequestTime) * 1000.0);
+
+	OnCaptureFinalized.Broadcast(VideoFilename, bSucceeded, GetCaptureStats());
+}
+
+FCaptureStats UVideoCaptureSubsystem::GetCaptureStats() const
+{
+	FCaptureStats Stats;
+	Telemetry.GetStats(Stats);
+
+	// A background start or stop owns the pipeline, only the telemetry is safe to read.
+	if (IsPipelineInBackground()) {
+		return Stats;
+	}
+
+	Stats.QueueDepth = GetEncodeQueueDepth();
+	Stats.DroppedFrames = EncoderThread != nullptr ? EncoderThread->GetDroppedFrameCount() : DroppedFrameCount;
+	Stats.DuplicatedFrames = GetElidedFrameCount();
+	Stats.DroppedAudioFrames = AudioDroppedFrames.GetValue();
+
+	if (AudioSubmixSampleRate > 0) {
+		Stats.AudioBacklogMs = AudioRingBuffer.Num() * 1000.f / AudioSubmixSampleRate;
+	}
+
+	return Stats;
+}
+
+bool UVideoCaptureSubsystem::BroadcastCaptureStats(float DeltaTime)
+{
+	OnCaptureStatsUpdated.Broadcast(GetCaptureStats());
+
+	return true;
+}
+
+int32 UVideoCaptureSubsystem::GetElidedFrameCount() const
+{
+	if (IsPipelineInBackground()) {
+		return 0;
+	}
+
+	return VideoEncoder != nullptr ? VideoEncoder->GetElidedFrameCount() : ElidedFrameCount;
+}
+
+int32 UVideoCaptureSubsystem::GetEncodeQueueDepth() const
+{
+	if (IsPipelineInBackground()) {
+		return 0;
+	}
+
+	return EncoderThread != nullptr ? EncoderThread->GetQueueDepth() : 0;
+}
+
+TFuture<bool> UVideoCaptureSubsystem::InitReadbackTextures()
+{
+	ReleaseReadbackTextures();
+
+	ReadbackSlots.SetNum(FMath::Clamp(CaptureConfigs.ReadbackBufferCount, 1, 8));
+	CopyingSlots.Reset();
+
+	UVideoCaptureSubsystem* This = this;
+	TSharedRef<TPromise<bool>, ESPMode::ThreadSafe> Created = MakeShared<TPromise<bool>, ESPMode::ThreadSafe>();
+
+	// Fulfilled by the render thread, nobody blocks on it but the background start.
+	ENQUEUE_RENDER_COMMAND(CreateCaptureFrameTextures)(
+		[This, Created](FRHICommandListImmediate& RHICmdList)
+		{
+			bool bCreated = true;
+
+			for (FCaptureReadbackSlot& Slot : This->ReadbackSlots)
+			{
+				FRHIResourceCreateInfo CreateInfo;
+
+				Slot.Texture = RHICreateTexture2D(
+					This->ViewportSize.X,
+					This->ViewportSize.Y,
+					EPixelFormat::PF_B8G8R8A8,
+					1,
+					1,
+					TexCreate_CPUReadback,
+					CreateInfo
+				);
+
+				Slot.Fence = RHICreateGPUFence(TEXT("CaptureReadbackFence"));
+
+				bCreated &= Slot.Texture != nullptr && Slot.Fence != nullptr;
+			}
+
+			Created->SetValue(bCreated);
+		});
+
+	SET_MEMORY_STAT(STAT_EasyFFMPEG_ReadbackMemory, int64(ReadbackSlots.Num()) * ViewportSize.X * ViewportSize.Y * sizeof(FColor));
+
+	return Created->GetFuture();
+}
+
+TFuture<void> UVideoCaptureSubsystem::FlushPendingReadbacks()
+{
+	TSharedRef<TPromise<void>, ESPMode::ThreadSafe> Flushed = MakeShared<TPromise<void>, ESPMode::ThreadSafe>();
+
+	if (ReadbackSlots.Num() == 0 || EncoderThread == nullptr) {
+		Flushed->SetValue();
+		return Flushed->GetFuture();
+	}
+
+	// Hand whatever is still in flight to the encoder, the back buffer delegate is already unbound so nothing new gets queued.
+	UVideoCaptureSubsystem* This = this;
+
+	ENQUEUE_RENDER_COMMAND(FlushCaptureReadbacks)(
+		[This, Flushed](FRHICommandListImmediate& RHICmdList)
+		{
+			This->ProcessPendingReadbacks_RenderThread(MAX_int32);
+			Flushed->SetValue();
+		});
 
-	CaptureState = EMovieCaptureState::NotInit;
+	return Flushed->GetFuture();
 }
 
-bool UVideoCaptureSubsystem::InitReadbackTexture()
+void UVideoCaptureSubsystem::ReleaseReadbackTextures()
 {
-	ReadbackTexture.SafeRelease();
-
-	UVideoCaptureSubsystem* This = this;
+	if (ReadbackSlots.Num() == 0) {
+		return;
+	}
 
-	ENQUEUE_RENDER_COMMAND(CreateCaptureFrameTexture)(
-		[This](FRHICommandListImmediate& RHICmdList)
+	// The encoder thread is stopped by now, so every surface it was reading can be unmapped. The render command owns the
+	// slots from here on, a new capture creates its own.
+	ENQUEUE_RENDER_COMMAND(ReleaseCaptureReadbacks)(
+		[Slots = MoveTemp(ReadbackSlots)](FRHICommandListImmediate& RHICmdList) mutable
 		{
-			FRHIResourceCreateInfo CreateInfo;
-
-			This->ReadbackTexture = RHICreateTexture2D(
-				This->ViewportSize.X,
-				This->ViewportSize.Y,
-				EPixelFormat::PF_B8G8R8A8,
-				1,
-				1,
-				TexCreate_CPUReadback,
-				CreateInfo
-			);
+			for (FCaptureReadbackSlot& Slot : Slots)
+			{
+				if (Slot.State == ECaptureReadbackState::Encoding) {
+					RHICmdList.UnmapStagingSurface(Slot.Texture);
+				}
+
+				Slot.Texture.SafeRelease();
+				Slot.Fence.SafeRelease();
+			}
 		});
 
-	FRenderCommandFence createTextureFence;
-	createTextureFence.BeginFence(true);
-	createTextureFence.Wait();
+	ReadbackSlots.Empty();
+	CopyingSlots.Reset();
 
-	return ReadbackTexture != nullptr;
+	SET_MEMORY_STAT(STAT_EasyFFMPEG_ReadbackMemory, 0);
 }
 
 bool UVideoCaptureSubsystem::FindViewportWindow()
@@ -459,60 +835,255 @@ bool UVideoCaptureSubsystem::FindViewportWindow()
 
 bool UVideoCaptureSubsystem::CreateVideoFileWriter()
 {
-	if (IFileManager::Get().FileExists(*VideoFilename)) {
-		IFileManager::Get().Delete(*VideoFilename);
-	}
+	DestroyVideoFileWriter();
 
-	Writer = IFileManager::Get().CreateFileWriter(*VideoFilename, EFileWrite::FILEWRITE_Append);
+	Writer = new FVideoCaptureFileWriter(CaptureConfigs.IOBufferSizeMB * 1024 * 1024, CaptureConfigs.IOBufferCount, CaptureConfigs.bFragmentedOutput);
+
+	return Writer->Open(VideoFilename);
+}
+
+bool UVideoCaptureSubsystem::DestroyVideoFileWriter()
+{
 	if (Writer == nullptr) {
+		return true;
+	}
+
+	const bool bClosed = Writer->Close();
+	if (!bClosed) {
+		UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Writing the video file '%s' failed, it is incomplete."), *VideoFilename);
+	}
+
+	delete Writer;
+	Writer = nullptr;
+
+	return bClosed;
+}
+
+bool UVideoCaptureSubsystem::StartEncoderThread()
+{
+	StopEncoderThread();
+
+	UVideoCaptureSubsystem* This = this;
+
+	if (CaptureConfigs.bAdaptiveEncoder) {
+		EncoderGovernor = new FVideoEncoderGovernor(VideoEncoder->GetCodecContext(), CaptureConfigs);
+	}
+
+	EncoderThread = new FVideoCaptureEncoderThread(CaptureConfigs.EncodeQueueDepth,
+		[This](const FCapturedVideoFrame& CapturedFrame)
+		{
+			EASYFFMPEG_SCOPE_CYCLE_COUNTER(STAT_EasyFFMPEG_EncodeFrame);
+
+			const double StartTime = FPlatformTime::Seconds();
+
+			This->VideoEncoder->EncodeBGRA(CapturedFrame.ColorData, CapturedFrame.RowPitch, This->GetFramePts(CapturedFrame));
+			This->Telemetry.AddEncodedFrame(FPlatformTime::Cycles64() - CapturedFrame.CaptureCycles);
+
+			VideoCaptureStats::AddFrameTiming(This->VideoEncoder->GetLastFrameTiming());
+			SET_DWORD_STAT(STAT_EasyFFMPEG_ElidedFrames, This->VideoEncoder->GetElidedFrameCount());
+			SET_DWORD_STAT(STAT_EasyFFMPEG_EncodeQueueDepth, This->EncoderThread->GetQueueDepth());
+
+			if (CapturedFrame.ReadbackSlot != INDEX_NONE) {
+				This->ReadbackSlots[CapturedFrame.ReadbackSlot].bEncoded = true;
+			}
+
+			if (This->EncoderGovernor != nullptr) {
+				This->EncoderGovernor->Update(FPlatformTime::Seconds() - StartTime, This->EncoderThread->GetQueueDepth());
+			}
+		});
+
+	return EncoderThread->Start();
+}
+
+void UVideoCaptureSubsystem::StopEncoderThread()
+{
+	if (EncoderThread == nullptr) {
+		return;
+	}
+
+	EncoderThread->StopAndFlush();
+
+	DroppedFrameCount = EncoderThread->GetDroppedFrameCount();
+	if (DroppedFrameCount > 0) {
+		UE_LOG(LogVideoCaptureSubsystem, Warning, TEXT("%d frames were dropped because the encoder fell behind."), DroppedFrameCount);
+	}
+
+	if (VideoEncoder->GetElidedFrameCount() > 0) {
+		UE_LOG(LogVideoCaptureSubsystem, Log, TEXT("%d static frames were not converted again."), VideoEncoder->GetElidedFrameCount());
+	}
+
+	delete EncoderThread;
+	EncoderThread = nullptr;
+
+	SET_MEMORY_STAT(STAT_EasyFFMPEG_FrameBufferMemory, 0);
+	SET_DWORD_STAT(STAT_EasyFFMPEG_EncodeQueueDepth, 0);
+
+	if (EncoderGovernor != nullptr) {
+		if (EncoderGovernor->GetLevel() > 0) {
+			UE_LOG(LogVideoCaptureSubsystem, Log, TEXT("Capture ended %d encoder quality steps below the configured settings."), EncoderGovernor->GetLevel());
+		}
+
+		delete EncoderGovernor;
+		EncoderGovernor = nullptr;
+	}
+}
+
+void UVideoCaptureSubsystem::StopAudioEncoderThread()
+{
+	if (AudioEncoderThread == nullptr) {
+		return;
+	}
+
+	AudioEncoderThread->StopAndFlush();
+
+	delete AudioEncoderThread;
+	AudioEncoderThread = nullptr;
+
+	float AverageMs = 0.f;
+	float MaxMs = 0.f;
+	GetAudioCallbackTiming(AverageMs, MaxMs);
+	UE_LOG(LogVideoCaptureSubsystem, Log, TEXT("Audio callback: %lld calls, %.3f ms average, %.3f ms max."), AudioCallbackCount.GetValue(), AverageMs, MaxMs);
+
+	if (AudioDroppedFrames.GetValue() > 0) {
+		UE_LOG(LogVideoCaptureSubsystem, Warning, TEXT("%d audio frames were dropped because the audio encoder fell behind."), AudioDroppedFrames.GetValue());
+	}
+}
+
+void UVideoCaptureSubsystem::GetAudioCallbackTiming(float& AverageMs, float& MaxMs) const
+{
+	const int64 Count = AudioCallbackCount.GetValue();
+
+	AverageMs = Count > 0 ? float(FPlatformTime::ToMilliseconds64(AudioCallbackCycles.GetValue() / Count)) : 0.f;
+	MaxMs = float(FPlatformTime::ToMilliseconds64(AudioCallbackMaxCycles.GetValue()));
+}
+
+bool UVideoCaptureSubsystem::SaveReplay(const FString& Filename)
+{
+	if (IsPipelineInBackground() || ReplayBuffer == nullptr) {
+		UE_LOG(LogVideoCaptureSubsystem, Warning, TEXT("SaveReplay() needs a capture started with bReplayBuffer."));
+		return false;
+	}
+
+	if (ReplaySaveTask.IsValid() && !ReplaySaveTask.IsReady()) {
+		UE_LOG(LogVideoCaptureSubsystem, Warning, TEXT("A replay is still being saved, ignoring SaveReplay('%s')."), *Filename);
 		return false;
 	}
 
+	UE_LOG(LogVideoCaptureSubsystem, Log, TEXT("Saving %.1f s (%.1f MB) of replay into '%s'."),
+		ReplayBuffer->GetBufferedSeconds(), ReplayBuffer->GetBufferedBytes() / (1024.0 * 1024.0), *Filename);
+
+	// Referenced now, so the replay ends at the moment of the call however long the write takes.
+	TArray<AVPacket*> Packets = ReplayBuffer->Snapshot();
+
+	FVideoCaptureReplayBuffer* Buffer = ReplayBuffer;
+	const int32 IOBufferSize = CaptureConfigs.IOBufferSizeMB * 1024 * 1024;
+	const int32 IOBufferCount = CaptureConfigs.IOBufferCount;
+	TWeakObjectPtr<UVideoCaptureSubsystem> WeakThis(this);
+
+	ReplaySaveTask = Async(EAsyncExecution::Thread, [Buffer, Filename, Packets = MoveTemp(Packets), IOBufferSize, IOBufferCount, WeakThis]() mutable
+	{
+		const bool bSaved = Buffer->WriteToFile(Filename, MoveTemp(Packets), IOBufferSize, IOBufferCount);
+
+		AsyncTask(ENamedThreads::GameThread, [WeakThis, Filename, bSaved]()
+		{
+			if (WeakThis.IsValid()) {
+				WeakThis->OnReplaySaved.Broadcast(Filename, bSaved);
+			}
+		});
+
+		return bSaved;
+	});
+
 	return true;
 }
 
-void UVideoCaptureSubsystem::DestroyVideoFileWriter()
+void UVideoCaptureSubsystem::GetReplayBufferUsage(float& BufferedSeconds, float& BufferedMB) const
 {
-	if (Writer == nullptr) {
+	if (IsPipelineInBackground()) {
+		BufferedSeconds = 0.f;
+		BufferedMB = 0.f;
 		return;
 	}
 
-	Writer->Flush();
-	Writer->Close();
+	BufferedSeconds = ReplayBuffer != nullptr ? float(ReplayBuffer->GetBufferedSeconds()) : 0.f;
+	BufferedMB = ReplayBuffer != nullptr ? float(ReplayBuffer->GetBufferedBytes() / (1024.0 * 1024.0)) : 0.f;
+}
 
-	delete Writer;
-	Writer = nullptr;
+void UVideoCaptureSubsystem::DestroyReplayBuffer()
+{
+	if (ReplaySaveTask.IsValid()) {
+		ReplaySaveTask.Wait();
+		ReplaySaveTask.Reset();
+	}
+
+	if (ReplayBuffer != nullptr) {
+		delete ReplayBuffer;
+		ReplayBuffer = nullptr;
+
+		SET_MEMORY_STAT(STAT_EasyFFMPEG_ReplayBufferMemory, 0);
+	}
 }
 
-void UVideoCaptureSubsystem::ReleaseContext()
+void UVideoCaptureSubsystem::SubmitPacket(AVPacket* InPacket)
 {
-	if (CaptureState != EMovieCaptureState::NotInit) {
-		EncodeVideoFrame(CodecCtx, nullptr, Packet);
+	Telemetry.AddBytes(InPacket->size);
 
-		av_write_trailer(FormatCtx);
+	if (ReplayBuffer != nullptr) {
+		ReplayBuffer->AddPacket(InPacket);
+		SET_MEMORY_STAT(STAT_EasyFFMPEG_ReplayBufferMemory, ReplayBuffer->GetBufferedBytes());
+	}
+	else {
+		MuxerThread->PostPacket(InPacket);
 	}
+}
 
-	if (CodecCtx != nullptr) {
-		avcodec_free_context(&CodecCtx);
-		CodecCtx = nullptr;
+bool UVideoCaptureSubsystem::ReleaseContext()
+{
+	bool bSucceeded = true;
+
+	if (CaptureState != EMovieCaptureState::NotInit && VideoEncoder != nullptr) {
+		VideoEncoder->Flush();
 	}
 
-	if (FormatCtx != nullptr) {
-		if (FormatCtx->pb != nullptr) {
-			avio_close(FormatCtx->pb);
+	// Replay and segmented captures never write a header into FormatCtx, so there is no trailer either.
+	const bool bWriteTrailer = CaptureState != EMovieCaptureState::NotInit && MuxerThread != nullptr && SegmentWriter == nullptr;
+
+	// The format context is only ours again once the muxer has written everything it was handed.
+	if (MuxerThread != nullptr) {
+		MuxerThread->StopAndFlush();
+
+		delete MuxerThread;
+		MuxerThread = nullptr;
+	}
+
+	if (bWriteTrailer && av_write_trailer(FormatCtx) < 0) {
+		UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Could not write the trailer of '%s'."), *VideoFilename);
+		bSucceeded = false;
+	}
+
+	// Finalizes the last segment and waits for the ones still being finalized in the background.
+	if (SegmentWriter != nullptr) {
+		if (!SegmentWriter->Finish()) {
+			UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Some segments of '%s' could not be written."), *VideoFilename);
+			bSucceeded = false;
 		}
-		avformat_free_context(FormatCtx);
-		FormatCtx = nullptr;
+
+		delete SegmentWriter;
+		SegmentWriter = nullptr;
 	}
 
-	if (Frame != nullptr) {
-		av_frame_free(&Frame);
-		Frame = nullptr;
+	if (VideoEncoder != nullptr) {
+		ElidedFrameCount = VideoEncoder->GetElidedFrameCount();
+
+		delete VideoEncoder;
+		VideoEncoder = nullptr;
 	}
 
-	if (Packet != nullptr) {
-		av_packet_free(&Packet);
-		Packet = nullptr;
+	if (FormatCtx != nullptr) {
+		// The IO context belongs to the file writer.
+		FormatCtx->pb = nullptr;
+		avformat_free_context(FormatCtx);
+		FormatCtx = nullptr;
 	}
 
 	if (AudioCodecCtx != nullptr) {
@@ -525,134 +1096,220 @@ void UVideoCaptureSubsystem::ReleaseContext()
 		AudioFrame = nullptr;
 	}
 
-	if (AudioTempFrame != nullptr) {
-		av_frame_free(&AudioTempFrame);
-		AudioTempFrame = nullptr;
+	if (AudioResampleFrame != nullptr) {
+		av_frame_free(&AudioResampleFrame);
+		AudioResampleFrame = nullptr;
 	}
 
 	if (AudioSwrCtx != nullptr) {
 		swr_free(&AudioSwrCtx);
 		AudioSwrCtx = nullptr;
 	}
+
+	return bSucceeded;
 }
 
-void UVideoCaptureSubsystem::WriteFrameToFile(const TArray<FColor>& ColorBuffer, int32 CurrentFrame)
+int64 UVideoCaptureSubsystem::GetFramePts(const FCapturedVideoFrame& CapturedFrame)
 {
-	AVFrame* rgbFrame = av_frame_alloc();
-	if (rgbFrame == nullptr) {
-		return;
+	if (!CaptureConfigs.bVariableFrameRate) {
+		return CapturedFrame.FrameNumber;
 	}
 
-	avpicture_fill((AVPicture*)rgbFrame, (uint8_t*)ColorBuffer.GetData(), AV_PIX_FMT_BGRA, CodecCtx->width, CodecCtx->height);
-
-	SwsContext* scaleCtx = sws_getContext(CodecCtx->width, CodecCtx->height, AV_PIX_FMT_BGRA,
-		CodecCtx->width, CodecCtx->height, CodecCtx->pix_fmt, SWS_BILINEAR, nullptr, nullptr, nullptr);
-	if (scaleCtx == nullptr) {
-		av_frame_free(&rgbFrame);
-		return;
-	}
+	const double CaptureSeconds = FPlatformTime::ToSeconds64(CapturedFrame.CaptureCycles - CaptureStartCycles);
 
-	int32 result = sws_scale(scaleCtx, rgbFrame->data, rgbFrame->linesize, 0, CodecCtx->height, Frame->data, Frame->linesize);
+	// Two frames presented within one clock tick still need increasing timestamps.
+	LastVideoPts = FMath::Max(LastVideoPts + 1, int64(FMath::RoundToDouble(CaptureSeconds * VideoEncoder->GetSettings().VariableFrameRateClock)));
 
-	av_frame_free(&rgbFrame);
-	sws_freeContext(scaleCtx);
+	return LastVideoPts;
+}
 
-	Frame->pts = CurrentFrame;
+void UVideoCaptureSubsystem::OnVideoPacket(AVPacket* InPacket)
+{
+	av_packet_rescale_ts(InPacket, VideoEncoder->GetCodecContext()->time_base, Stream->time_base);
 
-	if (result != CodecCtx->height) {
-		return;
-	}
+	InPacket->stream_index = Stream->index;
 
-	EncodeVideoFrame(CodecCtx, Frame, Packet);
+	SubmitPacket(InPacket);
 }
 
-void UVideoCaptureSubsystem::EncodeVideoFrame(AVCodecContext* InCodecCtx, AVFrame* InFrame, AVPacket* InPacket)
+void UVideoCaptureSubsystem::OnBackBufferReady_RenderThread(SWindow& SlateWindow, const FTexture2DRHIRef& BackBuffer)
 {
-	int32 result = avcodec_send_frame(InCodecCtx, InFrame);
-	if (result < 0) {
-		UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Error sending a frame for encoding."));
+	if (ViewportWindow != &SlateWindow || ReadbackSlots.Num() == 0)
+	{
 		return;
 	}
 
-	while (result >= 0)
-	{
-
-		InPacket->data = nullptr;
-		InPacket->size = 0;
+	UnmapEncodedReadbacks_RenderThread();
+	ProcessPendingReadbacks_RenderThread(0);
 
-		result = avcodec_receive_packet(InCodecCtx, InPacket);
-		if (result == AVERROR(EAGAIN) || result == AVERROR_EOF) {
-			return;
-		}
-		else if (result < 0) {
-			UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Error during encoding."));
+	// On a fixed timestep every presented frame is one video frame, otherwise pace on the wall clock.
+	if (!CaptureConfigs.bFixedTimestep)
+	{
+		std::chrono::steady_clock::time_point nowTime = std::chrono::steady_clock::now();
+		if (nowTime - PreFrameCaptureTime < CaptureFrameInterval)
+		{
 			return;
 		}
 
-		AVRational tempRational;
-		tempRational.num = CaptureConfigs.FrameRate.Y;
-		tempRational.den = CaptureConfigs.FrameRate.X;
-
-		av_packet_rescale_ts(InPacket, tempRational, Stream->time_base);
-
-		InPacket->stream_index = Stream->index;
+		PreFrameCaptureTime += CaptureFrameInterval;
 
-		result = av_interleaved_write_frame(FormatCtx, InPacket);
-		if (result < 0) {
-			UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Error during interleaved write frame."));
-			return;
+		// Variable frame rate captures are stamped with the real time, after a hitch just cap the rate again instead of
+		// catching up with a burst of frames.
+		if (CaptureConfigs.bVariableFrameRate && nowTime - PreFrameCaptureTime >= CaptureFrameInterval)
+		{
+			PreFrameCaptureTime = nowTime;
 		}
+	}
 
-		av_packet_unref(InPacket);
+	const int32 FrameNumber = CapturedFrameNumber++;
+
+	// Every slot is busy when the GPU is more than ReadbackSlots.Num() frames behind, only then wait for the oldest copy.
+	int32 SlotIndex = FindFreeReadbackSlot();
+	if (SlotIndex == INDEX_NONE && CopyingSlots.Num() > 0)
+	{
+		ProcessPendingReadbacks_RenderThread(1);
+		SlotIndex = FindFreeReadbackSlot();
 	}
-}
 
-void UVideoCaptureSubsystem::OnBackBufferReady_RenderThread(SWindow& SlateWindow, const FTexture2DRHIRef& BackBuffer)
-{
-	if (ViewportWindow != &SlateWindow)
+	// Offline captures never drop a frame, the render thread waits for the encoder to give a surface back instead.
+	while (SlotIndex == INDEX_NONE && CaptureConfigs.bFixedTimestep)
 	{
-		return;
+		FPlatformProcess::SleepNoStats(0.0001f);
+
+		UnmapEncodedReadbacks_RenderThread();
+		SlotIndex = FindFreeReadbackSlot();
 	}
 
-	std::chrono::steady_clock::time_point nowTime = std::chrono::steady_clock::now();
-	std::chrono::milliseconds passedTime = std::chrono::duration_cast<std::chrono::milliseconds>(nowTime - PreFrameCaptureTime);
-	if (passedTime < CaptureFrameInterval)
+	// Every surface is still being read by the encoder, it is too far behind to take this frame.
+	if (SlotIndex == INDEX_NONE)
 	{
+		EncoderThread->CountDroppedFrame();
+		SET_DWORD_STAT(STAT_EasyFFMPEG_DroppedVideoFrames, EncoderThread->GetDroppedFrameCount());
 		return;
 	}
 
-	PreFrameCaptureTime += CaptureFrameInterval;
+	FCaptureReadbackSlot& Slot = ReadbackSlots[SlotIndex];
+	Slot.FrameNumber = FrameNumber;
+	Slot.CaptureCycles = FPlatformTime::Cycles64();
+	Slot.State = ECaptureReadbackState::Copying;
 
-	BlockUntilAvailable();
-	InitAvailableEvent();
+	ResolveRenderTarget(BackBuffer, Slot);
 
-	ResolveRenderTarget(BackBuffer);
+	CopyingSlots.Add(SlotIndex);
 }
 
-void UVideoCaptureSubsystem::InitAvailableEvent()
+void UVideoCaptureSubsystem::ProcessPendingReadbacks_RenderThread(int32 MinReadbacks)
 {
-	check(!AvailableEvent);
-	AvailableEvent = FPlatformProcess::GetSynchEventFromPool();
+	EASYFFMPEG_SCOPE_CYCLE_COUNTER(STAT_EasyFFMPEG_MapReadback);
+
+	FRHICommandListImmediate& RHICmdList = GetImmediateCommandList_ForRenderCommand();
+
+	for (int32 Processed = 0; CopyingSlots.Num() > 0; Processed++)
+	{
+		const int32 SlotIndex = CopyingSlots[0];
+		FCaptureReadbackSlot& Slot = ReadbackSlots[SlotIndex];
+
+		if (Processed >= MinReadbacks && !Slot.Fence->Poll())
+		{
+			break;
+		}
+
+		CopyingSlots.RemoveAt(0, 1, false);
+		Slot.Fence->Clear();
+
+		FCapturedVideoFrame* CapturedFrame = CaptureConfigs.bFixedTimestep ? EncoderThread->WaitForFrame() : EncoderThread->AcquireFrame();
+		if (CapturedFrame == nullptr)
+		{
+			SET_DWORD_STAT(STAT_EasyFFMPEG_DroppedVideoFrames, EncoderThread->GetDroppedFrameCount());
+
+			Slot.FrameNumber = INDEX_NONE;
+			Slot.State = ECaptureReadbackState::Free;
+			continue;
+		}
+
+		void* ColorDataBuffer = nullptr;
+
+		int32 Width = 0, Height = 0;
+		RHICmdList.MapStagingSurface(Slot.Texture, ColorDataBuffer, Width, Height);
+
+		CapturedFrame->FrameNumber = Slot.FrameNumber;
+		CapturedFrame->CaptureCycles = Slot.CaptureCycles;
+		Slot.FrameNumber = INDEX_NONE;
+
+		// The encoder reads the surface in place and it stays mapped until then. That needs another free slot for the next
+		// copy though, so when this is the last one copy the visible rows into the frame's pooled buffer and release it now.
+		if (FindFreeReadbackSlot() != INDEX_NONE)
+		{
+			CapturedFrame->ColorData = static_cast<const uint8*>(ColorDataBuffer);
+			CapturedFrame->RowPitch = Width * sizeof(FColor);
+			CapturedFrame->ReadbackSlot = SlotIndex;
+
+			Slot.State = ECaptureReadbackState::Encoding;
+		}
+		else
+		{
+			const int32 SrcRowPitch = Width * sizeof(FColor);
+			const int32 DstRowPitch = ViewportSize.X * sizeof(FColor);
+
+			const int64 PreviousBufferSize = CapturedFrame->Buffer.GetAllocatedSize();
+			CapturedFrame->Buffer.SetNumUninitialized(DstRowPitch * ViewportSize.Y, false);
+			INC_MEMORY_STAT_BY(STAT_EasyFFMPEG_FrameBufferMemory, CapturedFrame->Buffer.GetAllocatedSize() - PreviousBufferSize);
+
+			for (int32 Row = 0; Row < ViewportSize.Y; Row++)
+			{
+				FMemory::Memcpy(CapturedFrame->Buffer.GetData() + Row * DstRowPitch, static_cast<const uint8*>(ColorDataBuffer) + Row * SrcRowPitch, DstRowPitch);
+			}
+
+			CapturedFrame->ColorData = CapturedFrame->Buffer.GetData();
+			CapturedFrame->RowPitch = DstRowPitch;
+			CapturedFrame->ReadbackSlot = INDEX_NONE;
+
+			RHICmdList.UnmapStagingSurface(Slot.Texture);
+			Slot.State = ECaptureReadbackState::Free;
+		}
+
+		EncoderThread->EnqueueFrame(CapturedFrame);
+	}
 }
 
-void UVideoCaptureSubsystem::BlockUntilAvailable()
+void UVideoCaptureSubsystem::UnmapEncodedReadbacks_RenderThread()
 {
-	if (AvailableEvent)
+	FRHICommandListImmediate& RHICmdList = GetImmediateCommandList_ForRenderCommand();
+
+	for (FCaptureReadbackSlot& Slot : ReadbackSlots)
 	{
-		AvailableEvent->Wait(~0);
+		if (Slot.State == ECaptureReadbackState::Encoding && Slot.bEncoded)
+		{
+			RHICmdList.UnmapStagingSurface(Slot.Texture);
+
+			Slot.bEncoded = false;
+			Slot.State = ECaptureReadbackState::Free;
+		}
+	}
+}
 
-		FPlatformProcess::ReturnSynchEventToPool(AvailableEvent);
-		AvailableEvent = nullptr;
+int32 UVideoCaptureSubsystem::FindFreeReadbackSlot() const
+{
+	for (int32 SlotIndex = 0; SlotIndex < ReadbackSlots.Num(); SlotIndex++)
+	{
+		if (ReadbackSlots[SlotIndex].State == ECaptureReadbackState::Free)
+		{
+			return SlotIndex;
+		}
 	}
+
+	return INDEX_NONE;
 }
 
-void UVideoCaptureSubsystem::ResolveRenderTarget(const FTexture2DRHIRef& SourceBackBuffer)
+void UVideoCaptureSubsystem::ResolveRenderTarget(const FTexture2DRHIRef& SourceBackBuffer, FCaptureReadbackSlot& Slot)
 {
+	EASYFFMPEG_SCOPE_CYCLE_COUNTER(STAT_EasyFFMPEG_ResolveRenderTarget);
+
 	static const FName RendererModuleName("Renderer");
 	// @todo: JIRA UE-41879 and UE-43829 - added defensive guards against memory trampling on this render command to try and ascertain why it occasionally crashes
 	uint32 MemoryGuard1 = 0xaffec7ed;
 
-	// Load the renderer module on the main thread, as the module manager is not thread-safe, and copy the ptr into the render command, along with 'this' (which is protected by BlockUntilAvailable in ~FViewportSurfaceReader())
+	// Load the renderer module on the main thread, as the module manager is not thread-safe, and copy the ptr into the render command, along with 'this' (which is protected by ReleaseReadbackTextures() in StopCapture())
 	IRendererModule* RendererModule = &FModuleManager::GetModuleChecked<IRendererModule>(RendererModuleName);
 
 	uint32 MemoryGuard2 = 0xaffec7ed;
@@ -661,11 +1318,11 @@ void UVideoCaptureSubsystem::ResolveRenderTarget(const FTexture2DRHIRef& SourceB
 	{
 		FRHICommandListImmediate& RHICmdList = GetImmediateCommandList_ForRenderCommand();
 
-		const FIntPoint TargetSize(ReadbackTexture->GetSizeX(), ReadbackTexture->GetSizeY());
+		const FIntPoint TargetSize(Slot.Texture->GetSizeX(), Slot.Texture->GetSizeY());
 
 		FPooledRenderTargetDesc OutputDesc = FPooledRenderTargetDesc::Create2DDesc(
 			TargetSize,
-			ReadbackTexture->GetFormat(),
+			Slot.Texture->GetFormat(),
 			FClearValueBinding::None,
 			TexCreate_None,
 			TexCreate_RenderTargetable,
@@ -677,7 +1334,7 @@ void UVideoCaptureSubsystem::ResolveRenderTarget(const FTexture2DRHIRef& SourceB
 
 		const FSceneRenderTargetItem& DestRenderTarget = ResampleTexturePooledRenderTarget->GetRenderTargetItem();
 
-		FRHIRenderPassInfo RPInfo(DestRenderTarget.TargetableTexture, ERenderTargetActions::Load_Store, ReadbackTexture);
+		FRHIRenderPassInfo RPInfo(DestRenderTarget.TargetableTexture, ERenderTargetActions::Load_Store, Slot.Texture);
 		RHICmdList.BeginRenderPass(RPInfo, TEXT("FrameGrabberResolveRenderTarget"));
 		{
 			RHICmdList.SetViewport(0, 0, 0.0f, TargetSize.X, TargetSize.Y, 1.0f);
@@ -723,21 +1380,94 @@ void UVideoCaptureSubsystem::ResolveRenderTarget(const FTexture2DRHIRef& SourceB
 		}
 		RHICmdList.EndRenderPass();
 
+		// Mapped later by ProcessPendingReadbacks_RenderThread() once the copy has finished, instead of stalling here.
+		RHICmdList.WriteGPUFence(Slot.Fence);
+	};
+}
 
-		void* ColorDataBuffer = nullptr;
+bool UVideoCaptureSubsystem::InitAudioEncoder()
+{
+	AudioCodec = avcodec_find_encoder(FormatCtx->oformat->audio_codec);
+	if (AudioCodec == nullptr) {
+		UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Codec not found."));
+		return false;
+	}
 
-		int32 Width = 0, Height = 0;
-		RHICmdList.MapStagingSurface(ReadbackTexture, ColorDataBuffer, Width, Height);
+	AudioStream = avformat_new_stream(FormatCtx, AudioCodec);
+	if (AudioStream == nullptr) {
+		UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Can not allocate a new stream."));
+		return false;
+	}
+
+	AudioStream->id = FormatCtx->nb_streams - 1;
+
+	AudioCodecCtx = avcodec_alloc_context3(AudioCodec);
+	if (AudioCodec == nullptr) {
+		UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("InitCapture() failed: Cloud not allocate audio codec context."));
+		return false;
+	}
+
+	AudioCodecCtx->sample_fmt = AV_SAMPLE_FMT_FLTP;
+	AudioCodecCtx->bit_rate = 196608;
+	AudioCodecCtx->sample_rate = 48000;
+	AudioCodecCtx->channel_layout = AV_CH_LAYOUT_STEREO;
+	AudioCodecCtx->channels = av_get_channel_layout_nb_channels(AudioCodecCtx->channel_layout);
 
-		TArray<FColor> ColorData;
-		ColorData.AddUninitialized(Width * Height);
-		FMemory::Memcpy(ColorData.GetData(), ColorDataBuffer, Width * Height * sizeof(FColor));
+	if (FormatCtx->oformat->flags & AVFMT_GLOBALHEADER) {
+		AudioCodecCtx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+	}
 
-		WriteFrameToFile(ColorData, CapturedFrameNumber++);
+	avcodec_parameters_from_context(AudioStream->codecpar, AudioCodecCtx);
 
-		RHICmdList.UnmapStagingSurface(ReadbackTexture);
-		AvailableEvent->Trigger();
-	};
+	AudioStream->time_base = { 1, AudioCodecCtx->sample_rate };
+
+	if (avcodec_open2(AudioCodecCtx, AudioCodec, nullptr) < 0) {
+		UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Cloud not open audio codec."));
+		return false;
+	}
+
+	int32 SamplesCount = 0;
+	if (AudioCodecCtx->codec->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE) {
+		SamplesCount = 10000;
+	}
+	else {
+		SamplesCount = AudioCodecCtx->frame_size;
+	}
+
+	AudioFrame = AllocAudioFrame(AudioCodecCtx->sample_fmt, AudioCodecCtx->channel_layout, AudioCodecCtx->sample_rate, SamplesCount);
+	AudioFrameFill = 0;
+
+	// The submix runs at the audio device rate (read by StartCapture), only resample when that is not the codec rate.
+	if (AudioSubmixSampleRate == 0) {
+		AudioSubmixSampleRate = AudioCodecCtx->sample_rate;
+	}
+	const int32 SubmixSampleRate = AudioSubmixSampleRate;
+
+	if (SubmixSampleRate != AudioCodecCtx->sample_rate) {
+		UE_LOG(LogVideoCaptureSubsystem, Log, TEXT("Resampling the submix audio from %d Hz to %d Hz."), SubmixSampleRate, AudioCodecCtx->sample_rate);
+
+		AudioSwrCtx = swr_alloc_set_opts(nullptr,
+			AudioCodecCtx->channel_layout, AudioCodecCtx->sample_fmt, AudioCodecCtx->sample_rate,
+			AudioCodecCtx->channel_layout, AV_SAMPLE_FMT_FLTP, SubmixSampleRate, 0, nullptr);
+
+		if (AudioSwrCtx == nullptr || swr_init(AudioSwrCtx) < 0) {
+			UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Failed to initialize the resampling context."));
+			return false;
+		}
+
+		AudioResampleFrame = AllocAudioFrame(AV_SAMPLE_FMT_FLTP, AudioCodecCtx->channel_layout, SubmixSampleRate, SamplesCount);
+	}
+
+	// A second of audio, and always room for a few codec frames on top of a late callback.
+	AudioRingBuffer.Init(FMath::Max(SubmixSampleRate, SamplesCount * 4), AudioEncoderChannels);
+	SET_MEMORY_STAT(STAT_EasyFFMPEG_AudioBufferMemory, AudioEncoderChannels * AudioRingBuffer.GetCapacity() * sizeof(float));
+
+	if (avcodec_parameters_from_context(AudioStream->codecpar, AudioCodecCtx) < 0) {
+		UE_LOG(LogVideoCaptureSubsystem, Error, TEXT("Cloud not copy the stream parameters."));
+		return false;
+	}
+
+	return true;
 }
 
 AVFrame* UVideoCaptureSubsystem::AllocAudioFrame(AVSampleFormat Format, uint64 ChannelLayout, int32 SampleRate, int32 SamplesCount)
@@ -0,0 +1,132 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "VideoColorConversion.h"
+#include "CaptureCore/CaptureColorConversion.h"
+
+#include "EasyFFMPEG.h"
+#include "HAL/IConsoleManager.h"
+#include "Async/ParallelFor.h"
+
+extern "C" {
+#include "libavutil/imgutils.h"
+#include "libavutil/pixdesc.h"
+#include "libswscale/swscale.h"
+}
+
+namespace VideoColorConversion
+{
+	FCaptureParallelFor GetParallelFor()
+	{
+		return [](int32_t NumTasks, const std::function<void(int32_t Task)>& Body)
+		{
+			ParallelFor(NumTasks, [&Body](int32 Task) { Body(Task); });
+		};
+	}
+
+	/** Compares only the visible bytes of every plane, the row padding of av_image_alloc is never written. */
+	static bool PlanesMatch(uint8* const A[4], const int32 APitch[4], uint8* const B[4], const int32 BPitch[4], int32 Width, int32 Height, AVPixelFormat Format)
+	{
+		const AVPixFmtDescriptor* Desc = av_pix_fmt_desc_get(Format);
+
+		for (int32 Plane = 0; Plane < 4 && A[Plane] != nullptr; Plane++)
+		{
+			const int32 RowBytes = av_image_get_linesize(Format, Width, Plane);
+			const int32 Rows = Plane == 1 || Plane == 2 ? AV_CEIL_RSHIFT(Height, Desc->log2_chroma_h) : Height;
+
+			for (int32 Y = 0; Y < Rows; Y++)
+			{
+				if (FMemory::Memcmp(A[Plane] + Y * APitch[Plane], B[Plane] + Y * BPitch[Plane], RowBytes) != 0) {
+					return false;
+				}
+			}
+		}
+
+		return true;
+	}
+
+	/** Times every kernel available on this CPU against swscale on a random frame, and checks the SIMD kernels match the scalar one bit for bit. */
+	static void RunBenchmark(const TArray<FString>& Args)
+	{
+		const int32 Width = Args.IsValidIndex(0) ? FCString::Atoi(*Args[0]) : 1920;
+		const int32 Height = Args.IsValidIndex(1) ? FCString::Atoi(*Args[1]) : 1080;
+		const int32 Iterations = Args.IsValidIndex(2) ? FCString::Atoi(*Args[2]) : 100;
+		const AVPixelFormat Format = Args.IsValidIndex(3) && Args[3] == TEXT("NV12") ? AV_PIX_FMT_NV12 : AV_PIX_FMT_YUV420P;
+		const int32 NumSlices = Args.IsValidIndex(4) ? FCString::Atoi(*Args[4]) : 1;
+
+		if (Width <= 0 || Height <= 0 || Iterations <= 0 || NumSlices <= 0) {
+			UE_LOG(LogFFmpeg, Warning, TEXT("Usage: EasyFFMPEG.BenchmarkColorConversion [Width] [Height] [Iterations] [I420|NV12] [Slices]"));
+			return;
+		}
+
+		TArray<uint8> Source;
+		Source.SetNumUninitialized(Width * Height * 4);
+
+		FRandomStream Random(Width * Height);
+		for (uint8& Byte : Source)
+		{
+			Byte = uint8(Random.RandHelper(256));
+		}
+
+		uint8* Reference[4] = { nullptr };
+		uint8* Output[4] = { nullptr };
+		int32 ReferencePitch[4] = { 0 };
+		int32 OutputPitch[4] = { 0 };
+		av_image_alloc(Reference, ReferencePitch, Width, Height, Format, 32);
+		av_image_alloc(Output, OutputPitch, Width, Height, Format, 32);
+
+		const FCaptureParallelFor SliceParallelFor = GetParallelFor();
+
+		CaptureColorConversion::ConvertBGRAToYUVWithKernel("Scalar", Source.GetData(), Width * 4, Width, Height, Reference, ReferencePitch, Format, AVCOL_SPC_BT709, false);
+
+		for (const char* Kernel : CaptureColorConversion::GetAvailableKernels())
+		{
+			const double StartTime = FPlatformTime::Seconds();
+			for (int32 Iteration = 0; Iteration < Iterations; Iteration++)
+			{
+				CaptureColorConversion::ConvertBGRAToYUVWithKernel(Kernel, Source.GetData(), Width * 4, Width, Height, Output, OutputPitch, Format, AVCOL_SPC_BT709, false, NumSlices, SliceParallelFor);
+			}
+			const double Elapsed = FPlatformTime::Seconds() - StartTime;
+
+			const bool bMatches = PlanesMatch(Reference, ReferencePitch, Output, OutputPitch, Width, Height, Format);
+
+			UE_LOG(LogFFmpeg, Display, TEXT("%-8s %dx%d x%d slices: %.3f ms/frame%s"), UTF8_TO_TCHAR(Kernel), Width, Height, NumSlices, Elapsed * 1000.0 / Iterations, bMatches ? TEXT("") : TEXT(" (MISMATCH with scalar)"));
+		}
+
+		{
+			const double StartTime = FPlatformTime::Seconds();
+			for (int32 Iteration = 0; Iteration < Iterations; Iteration++)
+			{
+				CaptureColorConversion::HashBGRA(Source.GetData(), Width * 4, Width, Height, NumSlices, SliceParallelFor);
+			}
+			const double Elapsed = FPlatformTime::Seconds() - StartTime;
+
+			UE_LOG(LogFFmpeg, Display, TEXT("%-8s %dx%d x%d slices: %.3f ms/frame"), TEXT("Hash"), Width, Height, NumSlices, Elapsed * 1000.0 / Iterations);
+		}
+
+		SwsContext* ScaleCtx = nullptr;
+		if (CaptureColorConversion::ConvertBGRAWithSwscale(ScaleCtx, Source.GetData(), Width * 4, Width, Height, Output, OutputPitch, Format, AVCOL_SPC_BT709, false))
+		{
+			const double StartTime = FPlatformTime::Seconds();
+			for (int32 Iteration = 0; Iteration < Iterations; Iteration++)
+			{
+				CaptureColorConversion::ConvertBGRAWithSwscale(ScaleCtx, Source.GetData(), Width * 4, Width, Height, Output, OutputPitch, Format, AVCOL_SPC_BT709, false);
+			}
+			const double Elapsed = FPlatformTime::Seconds() - StartTime;
+
+			UE_LOG(LogFFmpeg, Display, TEXT("%-8s %dx%d: %.3f ms/frame"), TEXT("swscale"), Width, Height, Elapsed * 1000.0 / Iterations);
+		}
+
+		if (ScaleCtx != nullptr) {
+			sws_freeContext(ScaleCtx);
+		}
+
+		av_freep(&Reference[0]);
+		av_freep(&Output[0]);
+	}
+
+	static FAutoConsoleCommand BenchmarkCommand(
+		TEXT("EasyFFMPEG.BenchmarkColorConversion"),
+		TEXT("Times the native BGRA -> YUV kernels against swscale. Arguments: [Width] [Height] [Iterations] [I420|NV12] [Slices]"),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&RunBenchmark));
+}
@@ -0,0 +1,16 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "CaptureCore/CaptureCoreTypes.h"
+
+/**
+ * Engine side of the capture core's BGRA -> YUV conversion (CaptureCore/CaptureColorConversion.h): runs its bands on
+ * the task graph and registers the EasyFFMPEG.BenchmarkColorConversion console command.
+ */
+namespace VideoColorConversion
+{
+	/** ParallelFor on the task graph, for FCaptureVideoEncoder::Open(). */
+	FCaptureParallelFor GetParallelFor();
+}
@@ -0,0 +1,104 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "VideoEncoderGovernor.h"
+#include "EasyFFMPEG.h"
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+#include "libavutil/opt.h"
+}
+
+namespace
+{
+	/** Weight of the newest frame in the encode time average. */
+	constexpr double AverageWeight = 0.1;
+
+	/** Step down above this share of the frame budget, step up below the lower one. */
+	constexpr double OverloadedBudget = 0.9;
+	constexpr double HeadroomBudget = 0.6;
+
+	/** Per level: bitrate lost in ABR, CRF / QP added otherwise. */
+	constexpr double BitRateStep = 0.15;
+	constexpr float QualityStep = 2.f;
+
+	/** AdaptiveEncoderMaxSteps is only clamped in the editor, Blueprints can set anything. */
+	constexpr int32 MaxSteps = 6;
+
+	/** Never go below this share of the configured bitrate, whatever the level. */
+	constexpr double MinBitRateScale = 0.25;
+}
+
+FVideoEncoderGovernor::FVideoEncoderGovernor(AVCodecContext* InCodecCtx, const FCaptureConfigs& CaptureConfigs)
+	: CodecCtx(InCodecCtx)
+	, RateControl(CaptureConfigs.RateControl)
+	, BaseBitRate(InCodecCtx->bit_rate)
+	, BaseMaxBitRate(InCodecCtx->rc_max_rate)
+	, BaseCRF(CaptureConfigs.CRF)
+	, BaseQP(CaptureConfigs.QP)
+	, FrameBudget(double(CaptureConfigs.FrameRate.Y) / FMath::Max(CaptureConfigs.FrameRate.X, 1))
+	, MaxQueueDepth(CaptureConfigs.EncodeQueueDepth)
+	, MaxLevel(FMath::Clamp(CaptureConfigs.AdaptiveEncoderMaxSteps, 0, MaxSteps))
+	, SettleFrames(FMath::Max(CaptureConfigs.FrameRate.X / FMath::Max(CaptureConfigs.FrameRate.Y, 1), 1))
+{
+	AverageEncodeSeconds = FrameBudget * HeadroomBudget;
+}
+
+void FVideoEncoderGovernor::Update(double EncodeSeconds, int32 QueueDepth)
+{
+	AverageEncodeSeconds += (EncodeSeconds - AverageEncodeSeconds) * AverageWeight;
+	FramesSinceChange++;
+
+	const bool bOverloaded = AverageEncodeSeconds > FrameBudget * OverloadedBudget || QueueDepth > MaxQueueDepth / 2;
+	const bool bHeadroom = AverageEncodeSeconds < FrameBudget * HeadroomBudget && QueueDepth == 0;
+
+	HeadroomFrames = bHeadroom ? HeadroomFrames + 1 : 0;
+
+	// React to overload within a quarter of a second, but only give quality back after a few seconds of headroom.
+	if (bOverloaded && Level < MaxLevel && FramesSinceChange >= FMath::Max(SettleFrames / 4, 1)) {
+		SetLevel(Level + 1, TEXT("falling behind"), QueueDepth);
+	}
+	else if (Level > 0 && HeadroomFrames >= SettleFrames * 3 && FramesSinceChange >= SettleFrames) {
+		SetLevel(Level - 1, TEXT("headroom"), QueueDepth);
+	}
+}
+
+void FVideoEncoderGovernor::SetLevel(int32 NewLevel, const TCHAR* Reason, int32 QueueDepth)
+{
+	FString Setting;
+
+	switch (RateControl)
+	{
+	case ECaptureRateControl::ABR:
+	{
+		const double Scale = FMath::Max(1.0 - BitRateStep * NewLevel, MinBitRateScale);
+		CodecCtx->bit_rate = int64(BaseBitRate * Scale);
+		if (BaseMaxBitRate > 0) {
+			CodecCtx->rc_max_rate = int64(BaseMaxBitRate * Scale);
+		}
+		Setting = FString::Printf(TEXT("bitrate %lld kbit/s"), CodecCtx->bit_rate / 1000);
+		break;
+	}
+	case ECaptureRateControl::CRF:
+	{
+		const float CRF = FMath::Min(BaseCRF + QualityStep * NewLevel, 51.f);
+		av_opt_set_double(CodecCtx, "crf", CRF, AV_OPT_SEARCH_CHILDREN);
+		Setting = FString::Printf(TEXT("crf %.1f"), CRF);
+		break;
+	}
+	case ECaptureRateControl::CQP:
+	{
+		const int32 QP = FMath::Min(BaseQP + int32(QualityStep) * NewLevel, 51);
+		av_opt_set_int(CodecCtx, "qp", QP, AV_OPT_SEARCH_CHILDREN);
+		Setting = FString::Printf(TEXT("qp %d"), QP);
+		break;
+	}
+	}
+
+	UE_LOG(LogFFmpeg, Log, TEXT("Encoder governor: level %d -> %d (%s, %.2f ms/frame for a %.2f ms budget, %d frames queued), %s."),
+		Level, NewLevel, Reason, AverageEncodeSeconds * 1000.0, FrameBudget * 1000.0, QueueDepth, *Setting);
+
+	Level = NewLevel;
+	FramesSinceChange = 0;
+	HeadroomFrames = 0;
+}
@@ -0,0 +1,49 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "VideoCaptureStructures.h"
+
+struct AVCodecContext;
+
+/**
+ * Keeps the encoder real time by trading quality for speed while the capture runs.
+ * Each step lowers the bitrate (ABR) or raises CRF / QP, steps are taken back once there is headroom again.
+ * libx264 picks the new rate control up on the next frame, the preset itself cannot change after avcodec_open2.
+ */
+class FVideoEncoderGovernor
+{
+public:
+	FVideoEncoderGovernor(AVCodecContext* InCodecCtx, const FCaptureConfigs& CaptureConfigs);
+
+	/** Encoder thread only, between two frames. EncodeSeconds is the time the last frame took, QueueDepth the frames waiting behind it. */
+	void Update(double EncodeSeconds, int32 QueueDepth);
+
+	/** 0 when encoding with the configured settings. */
+	int32 GetLevel() const { return Level; }
+
+private:
+	void SetLevel(int32 NewLevel, const TCHAR* Reason, int32 QueueDepth);
+
+	AVCodecContext* CodecCtx;
+
+	ECaptureRateControl RateControl;
+	int64 BaseBitRate;
+	int64 BaseMaxBitRate;
+	float BaseCRF;
+	int32 BaseQP;
+
+	/** Seconds one frame may take to encode at the capture frame rate. */
+	double FrameBudget;
+	int32 MaxQueueDepth;
+	int32 MaxLevel;
+
+	/** Frames to wait after a change before judging its effect. */
+	int32 SettleFrames;
+
+	int32 Level = 0;
+	double AverageEncodeSeconds = 0.0;
+	int32 FramesSinceChange = 0;
+	int32 HeadroomFrames = 0;
+};
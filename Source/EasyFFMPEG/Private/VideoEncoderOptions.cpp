@@ -0,0 +1,96 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "VideoEncoderOptions.h"
+#include "CaptureCore/CaptureEncoderOptions.h"
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+}
+
+namespace VideoEncoderOptions
+{
+	/** Time base of variable frame rate captures, the usual 90 kHz video clock. */
+	static constexpr int32 VariableFrameRateClock = 90000;
+
+	/** The x264 names are the enumerator names in lower case, e.g. VeryFast -> "veryfast". */
+	template<typename EnumType>
+	static std::string GetOptionName(EnumType Value)
+	{
+		return TCHAR_TO_UTF8(*StaticEnum<EnumType>()->GetNameStringByValue(static_cast<int64>(Value)).ToLower());
+	}
+
+	FCaptureVideoSettings MakeVideoSettings(const FCaptureConfigs& CaptureConfigs, const FIntPoint& Size)
+	{
+		FCaptureVideoSettings Settings;
+
+		Settings.Width = Size.X;
+		Settings.Height = Size.Y;
+		Settings.FrameRateNum = CaptureConfigs.FrameRate.X;
+		Settings.FrameRateDen = CaptureConfigs.FrameRate.Y;
+		Settings.VariableFrameRateClock = CaptureConfigs.bVariableFrameRate ? VariableFrameRateClock : 0;
+		Settings.GopSize = CaptureConfigs.GopSize;
+		Settings.MaxBFrames = CaptureConfigs.MaxBFrames;
+		Settings.PixelFormat = CaptureConfigs.PixelFormat == ECapturePixelFormat::NV12 ? AV_PIX_FMT_NV12 : AV_PIX_FMT_YUV420P;
+		Settings.ColorSpace = CaptureConfigs.ColorMatrix == ECaptureColorMatrix::BT709 ? AVCOL_SPC_BT709 : AVCOL_SPC_SMPTE170M;
+		Settings.bFullRange = CaptureConfigs.bFullRange;
+		Settings.ConversionSlices = CaptureConfigs.ConversionThreads;
+		Settings.bElideStaticFrames = CaptureConfigs.bElideStaticFrames;
+
+		Settings.Preset = GetOptionName(CaptureConfigs.Preset);
+		if (CaptureConfigs.Tune != ECaptureEncoderTune::None) {
+			Settings.Tune = GetOptionName(CaptureConfigs.Tune);
+		}
+
+		switch (CaptureConfigs.RateControl)
+		{
+		case ECaptureRateControl::ABR:
+			Settings.RateControl = ECaptureCoreRateControl::ABR;
+			break;
+		case ECaptureRateControl::CRF:
+			Settings.RateControl = ECaptureCoreRateControl::CRF;
+			break;
+		case ECaptureRateControl::CQP:
+			Settings.RateControl = ECaptureCoreRateControl::CQP;
+			break;
+		}
+
+		// kbit/s and kbit
+		Settings.BitRate = CaptureConfigs.BitRate * 1000LL;
+		Settings.CRF = CaptureConfigs.CRF;
+		Settings.QP = CaptureConfigs.QP;
+		Settings.MaxBitRate = CaptureConfigs.MaxBitRate * 1000LL;
+		Settings.BufferSize = CaptureConfigs.BufferSize * 1000LL;
+
+		Settings.Threads = CaptureConfigs.EncoderThreads;
+
+		switch (CaptureConfigs.EncoderThreadType)
+		{
+		case ECaptureEncoderThreadType::Frame:
+			Settings.ThreadType = FF_THREAD_FRAME;
+			break;
+		case ECaptureEncoderThreadType::Slice:
+			Settings.ThreadType = FF_THREAD_SLICE;
+			break;
+		default:
+			break;
+		}
+
+		for (const TPair<FString, FString>& Option : CaptureConfigs.CodecOptions)
+		{
+			Settings.CodecOptions.emplace_back(TCHAR_TO_UTF8(*Option.Key), TCHAR_TO_UTF8(*Option.Value));
+		}
+
+		return Settings;
+	}
+
+	void ApplyMuxer(const AVOutputFormat* OutputFormat, const FCaptureConfigs& CaptureConfigs, AVDictionary** Options)
+	{
+		CaptureEncoderOptions::ApplyMuxer(OutputFormat, CaptureConfigs.bFragmentedOutput, CaptureConfigs.FragmentDuration, Options);
+	}
+
+	void ReportUnusedAndFree(AVDictionary** Options)
+	{
+		CaptureEncoderOptions::ReportUnusedAndFree(Options);
+	}
+}
@@ -0,0 +1,26 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "VideoCaptureStructures.h"
+#include "CaptureCore/CaptureCoreTypes.h"
+
+struct AVDictionary;
+struct AVOutputFormat;
+
+/**
+ * Translates the encoder and muxer parts of FCaptureConfigs into the settings of the capture core, shared by every
+ * capture front end. The core turns them into codec context fields and option dictionaries.
+ */
+namespace VideoEncoderOptions
+{
+	/** The core settings of a Size capture: codec, conversion and rate control. */
+	FCaptureVideoSettings MakeVideoSettings(const FCaptureConfigs& CaptureConfigs, const FIntPoint& Size);
+
+	/** Fills Options with the muxer settings for OutputFormat (fragmented MP4). */
+	void ApplyMuxer(const AVOutputFormat* OutputFormat, const FCaptureConfigs& CaptureConfigs, AVDictionary** Options);
+
+	/** Warns about every entry avcodec_open2 / avformat_write_header left in Options (i.e. it was not recognised) and frees it. */
+	void ReportUnusedAndFree(AVDictionary** Options);
+}
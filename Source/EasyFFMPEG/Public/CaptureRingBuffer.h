@@ -0,0 +1,103 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Templates/Atomic.h"
+
+/**
+ * Fixed capacity FIFO of sample frames, one sample per channel, stored planar. All channels share one read and one
+ * write position, so a Commit() publishes every channel at once. Storage is allocated once by Init(), the producer
+ * drops the frames that do not fit instead of growing it.
+ * Lock free for one producer (GetWriteSpans, Commit) and one consumer (Pop), Init / Release / Reset need both idle.
+ */
+template<typename SampleType>
+class TCaptureRingBuffer
+{
+public:
+	/** Capacity, in frames, is rounded up to a power of two. */
+	void Init(int32 InCapacity, int32 InNumChannels)
+	{
+		Capacity = FMath::RoundUpToPowerOfTwo(FMath::Max(InCapacity, 1));
+		NumChannels = FMath::Max(InNumChannels, 1);
+		Buffer.SetNumUninitialized(Capacity * NumChannels);
+		Mask = Capacity - 1;
+		Reset();
+	}
+
+	void Release()
+	{
+		Buffer.Empty();
+		Capacity = 0;
+		Mask = 0;
+		Reset();
+	}
+
+	void Reset()
+	{
+		ReadIndex = 0;
+		WriteIndex = 0;
+	}
+
+	/** Frames ready to be popped. */
+	int32 Num() const { return int32(WriteIndex.Load() - ReadIndex.Load()); }
+
+	int32 GetSlack() const { return Capacity - Num(); }
+
+	/** In frames, each channel holds this many samples. */
+	int32 GetCapacity() const { return Capacity; }
+
+	int32 GetNumChannels() const { return NumChannels; }
+
+	/**
+	 * Points OutPlanes[Channel] at the free space of every channel and returns how many frames fit there contiguously,
+	 * which may be less than GetSlack() when it wraps around. Fill them, then Commit().
+	 */
+	int32 GetWriteSpans(SampleType* OutPlanes[])
+	{
+		const uint32 Start = WriteIndex.Load(EMemoryOrder::Relaxed) & Mask;
+		for (int32 Channel = 0; Channel < NumChannels; Channel++)
+		{
+			OutPlanes[Channel] = Buffer.GetData() + Channel * Capacity + Start;
+		}
+		return FMath::Min<int32>(GetSlack(), Capacity - Start);
+	}
+
+	/** Publishes Count frames written through GetWriteSpans() to the consumer, every channel together. */
+	void Commit(int32 Count)
+	{
+		WriteIndex.Store(WriteIndex.Load(EMemoryOrder::Relaxed) + Count);
+	}
+
+	/** Removes the Count oldest frames into one plane per channel, or returns false and leaves the buffer untouched if there are fewer. */
+	bool Pop(SampleType* const OutPlanes[], int32 Count)
+	{
+		if (Num() < Count) {
+			return false;
+		}
+
+		const uint32 Start = ReadIndex.Load(EMemoryOrder::Relaxed) & Mask;
+		const int32 FirstPart = FMath::Min<int32>(Count, Capacity - Start);
+
+		for (int32 Channel = 0; Channel < NumChannels; Channel++)
+		{
+			const SampleType* Plane = Buffer.GetData() + Channel * Capacity;
+			FMemory::Memcpy(OutPlanes[Channel], Plane + Start, FirstPart * sizeof(SampleType));
+			FMemory::Memcpy(OutPlanes[Channel] + FirstPart, Plane, (Count - FirstPart) * sizeof(SampleType));
+		}
+
+		// Hands the space back to the producer only once the samples are copied out.
+		ReadIndex.Store(ReadIndex.Load(EMemoryOrder::Relaxed) + Count);
+		return true;
+	}
+
+private:
+	TArray<SampleType> Buffer;
+	int32 Capacity = 0;
+	int32 NumChannels = 1;
+	uint32 Mask = 0;
+
+	/** Free running, only masked when indexing so Num() stays correct across wrap around. */
+	TAtomic<uint32> ReadIndex{ 0 };
+	TAtomic<uint32> WriteIndex{ 0 };
+};
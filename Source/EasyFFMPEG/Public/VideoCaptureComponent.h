@@ -6,6 +6,7 @@
 #include "FrameGrabber.h"
 #include "Components/SceneComponent.h"
 #include "VideoCaptureStructures.h"
+#include "VideoCaptureTelemetry.h"
 #include "VideoCaptureComponent.generated.h"
 
 UCLASS( meta=(BlueprintSpawnableComponent) )
@@ -23,12 +24,17 @@ public:
 	UFUNCTION(BlueprintPure, Category = "Video Capture")
 	bool IsInitialized();
 
+	/** Encodes the last frame the grabber returned as CurrentFrame. With bFixedTimestep every returned frame is encoded and CurrentFrame is ignored. */
 	UFUNCTION(BlueprintCallable, Category = "Video Capture")
 	bool CaptureThisFrame(int32 CurrentFrame);
 
 	UFUNCTION(BlueprintCallable, Category = "Video Capture")
 	void StopCapture();
 
+	/** Cheap snapshot of the running capture, or of the last one once stopped. */
+	UFUNCTION(BlueprintPure, Category = "Video Capture")
+	FCaptureStats GetCaptureStats() const;
+
 protected:
 	// Called when the game starts
 	virtual void BeginPlay() override;
@@ -45,9 +51,8 @@ protected:
 
 	void ReleaseContext();
 
-	void WriteFrameToFile(const TArray<FColor>& ColorBuffer, int32 CurrentFrame);
-
-	void EncodeVideoFrame(struct AVCodecContext* InCodecCtx, struct AVFrame* InFrame, struct AVPacket* InPacket);
+	/** CaptureCycles is when the frame was asked from the grabber, the telemetry latency is measured from there. */
+	void WriteFrameToFile(const TArray<FColor>& ColorBuffer, int32 CurrentFrame, uint64 CaptureCycles);
 
 public:	
 	// Called every frame
@@ -64,22 +69,48 @@ public:
 	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Video Capture")
 	int32 CapturedFrameNumber = 0;
 
+	/** Fires every CaptureConfigs.StatsInterval seconds while capturing. */
+	UPROPERTY(BlueprintAssignable, Category = "Video Capture")
+	FOnCaptureStatsUpdated OnCaptureStatsUpdated;
+
 	EMovieCaptureState CaptureState;
 
 private:
 
-	struct AVFormatContext* FormatCtx;
-	struct AVCodec* Codec;
-	struct AVCodecContext* CodecCtx;
-	struct AVFrame* Frame;
-	struct AVPacket* Packet;
-	struct AVStream* Stream;
+	class FCaptureVideoEncoder* VideoEncoder;
+	class FCaptureFileMuxer* Muxer;
+	int32 VideoStreamIndex;
 
 	TSharedPtr<FFrameGrabber>	FrameGrabber;
-	FArchive* Writer;
+	class FVideoCaptureFileWriter* Writer;
 
 	int32 ShouldCutFrameCount;
 
+	/** Surfaces of the frame grabber, it drops the frame it is asked for when none is free. */
+	static constexpr int32 GrabberSurfaceCount = 3;
+
+	/** Frames asked from the grabber that have not come back yet, bFixedTimestep only waits on them. */
+	int32 PendingGrabberFrames;
+
+	/** Timestamp of the next frame of a bFixedTimestep capture. */
+	int32 EncodedFrameNumber;
+
+	/** Grabbed frames that were never encoded, outside bFixedTimestep only the newest frame of each tick is. */
+	int32 DroppedFrameCount;
+
 	FTimespan PassedTime;
 	FTimespan FrameTimeForCapture;
+
+	FVideoCaptureTelemetry Telemetry;
+
+	/** Seconds since OnCaptureStatsUpdated last fired. */
+	float StatsElapsedTime;
+
+	/** Elided frames of the last capture, kept once its encoder is gone. */
+	int32 ElidedFrameCount;
+
+	/** The engine's timestep settings from before a bFixedTimestep capture. */
+	bool bFixedTimestepApplied;
+	bool bSavedUseFixedTimeStep;
+	double SavedFixedDeltaTime;
 };
@@ -9,8 +9,78 @@ UENUM(BlueprintType)
 enum class EMovieCaptureState : uint8
 {
 	NotInit = 0,
+	/** StartCapture() is building the pipeline in the background. */
+	Starting,
 	Initialized,
 	Capturing,
+	/** StopCapture() returned, the file is being finalized in the background. */
+	Stopping,
+};
+
+UENUM(BlueprintType)
+enum class ECaptureColorMatrix : uint8
+{
+	BT601,
+	BT709,
+};
+
+UENUM(BlueprintType)
+enum class ECapturePixelFormat : uint8
+{
+	/** Planar YUV 4:2:0 */
+	I420,
+	/** Y plane followed by interleaved UV, 4:2:0 */
+	NV12,
+};
+
+/** x264 presets, from fastest to best compression. */
+UENUM(BlueprintType)
+enum class ECaptureEncoderPreset : uint8
+{
+	UltraFast,
+	SuperFast,
+	VeryFast,
+	Faster,
+	Fast,
+	Medium,
+	Slow,
+	Slower,
+	VerySlow,
+};
+
+UENUM(BlueprintType)
+enum class ECaptureEncoderTune : uint8
+{
+	None,
+	Film,
+	Animation,
+	Grain,
+	StillImage,
+	FastDecode,
+	/** Disables frame lookahead and B-frame delay, for streaming. */
+	ZeroLatency,
+};
+
+UENUM(BlueprintType)
+enum class ECaptureRateControl : uint8
+{
+	/** Average bitrate, targets BitRate. */
+	ABR,
+	/** Constant quality, targets CRF. */
+	CRF,
+	/** Constant quantizer, every frame is encoded with QP. */
+	CQP,
+};
+
+UENUM(BlueprintType)
+enum class ECaptureEncoderThreadType : uint8
+{
+	/** Let the codec decide. */
+	Auto,
+	/** Frame threading, best throughput but adds one frame of latency per thread. */
+	Frame,
+	/** Slice threading, each frame is split between the threads. */
+	Slice,
 };
 
 USTRUCT(BlueprintType)
@@ -30,4 +100,194 @@ public:
 
 	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite, Category = "Capture Configs")
 		int32	MaxBFrames = 1;
+
+	/** Number of staging textures the back buffer is copied into. Each frame is only mapped once its GPU copy has finished, so more buffers means more latency but fewer render thread stalls. */
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite, Category = "Capture Configs", meta = (ClampMin = "1", ClampMax = "8"))
+		int32	ReadbackBufferCount = 3;
+
+	/** Maximum number of read back frames waiting for the encoder thread. Frames captured while the queue is full are dropped. */
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite, Category = "Capture Configs", meta = (ClampMin = "1"))
+		int32	EncodeQueueDepth = 8;
+
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite, Category = "Capture Configs")
+		ECapturePixelFormat	PixelFormat = ECapturePixelFormat::I420;
+
+	/** YUV matrix the captured frames are converted with, also written into the stream so players decode it the same way. */
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite, Category = "Capture Configs")
+		ECaptureColorMatrix	ColorMatrix = ECaptureColorMatrix::BT709;
+
+	/** Use the full 0-255 range instead of the 16-235 video range. */
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite, Category = "Capture Configs")
+		bool	bFullRange = false;
+
+	/**
+	 * Offline capture: locks the engine to a 1 / FrameRate timestep and records every rendered frame, however fast or
+	 * slow it renders, so the output plays back at exactly FrameRate. The audio is not recorded.
+	 */
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite, Category = "Capture Configs")
+		bool	bFixedTimestep = false;
+
+	/**
+	 * Stamp every frame with the time it was captured at instead of its frame index. FrameRate then only caps how often
+	 * frames are taken, playback stays in sync with the audio even when the game renders slower. Ignored with bFixedTimestep.
+	 */
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite, Category = "Capture Configs")
+		bool	bVariableFrameRate = false;
+
+	/**
+	 * Skip the conversion and encoding of frames identical to the previous one (menus, loading screens, pauses). With
+	 * bVariableFrameRate the previous frame just lasts longer, otherwise it is encoded again, which costs next to nothing.
+	 */
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite, Category = "Capture Configs")
+		bool	bElideStaticFrames = false;
+
+	/** Number of horizontal bands each frame's color conversion is split into, converted in parallel on the task graph. */
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite, Category = "Capture Configs", meta = (ClampMin = "1", ClampMax = "64"))
+		int32	ConversionThreads = 4;
+
+	/** Encoder speed / compression trade off. Only used by H.264 and H.265. */
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite, Category = "Capture Configs|Encoder")
+		ECaptureEncoderPreset	Preset = ECaptureEncoderPreset::Slow;
+
+	/** Only used by H.264 and H.265. */
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite, Category = "Capture Configs|Encoder")
+		ECaptureEncoderTune	Tune = ECaptureEncoderTune::None;
+
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite, Category = "Capture Configs|Encoder")
+		ECaptureRateControl	RateControl = ECaptureRateControl::ABR;
+
+	/** Constant rate factor used with CRF rate control, lower is better quality. */
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite, Category = "Capture Configs|Encoder", meta = (ClampMin = "0", ClampMax = "51"))
+		float	CRF = 23.f;
+
+	/** Quantizer used with CQP rate control, lower is better quality. */
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite, Category = "Capture Configs|Encoder", meta = (ClampMin = "0", ClampMax = "51"))
+		int32	QP = 23;
+
+	/** VBV maximum bitrate in kbit/s for ABR and CRF, 0 leaves the bitrate unconstrained. */
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite, Category = "Capture Configs|Encoder", meta = (ClampMin = "0"))
+		int32	MaxBitRate = 0;
+
+	/** VBV buffer size in kbit, 0 uses MaxBitRate (one second of buffer). */
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite, Category = "Capture Configs|Encoder", meta = (ClampMin = "0"))
+		int32	BufferSize = 0;
+
+	/** Number of encoder threads, 0 lets the codec pick one per core. */
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite, Category = "Capture Configs|Encoder", meta = (ClampMin = "0"))
+		int32	EncoderThreads = 0;
+
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite, Category = "Capture Configs|Encoder")
+		ECaptureEncoderThreadType	EncoderThreadType = ECaptureEncoderThreadType::Auto;
+
+	/** Extra codec private options passed to avcodec_open2, e.g. "x264-params" or "profile". Applied last, so they override the settings above. */
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite, Category = "Capture Configs|Encoder")
+		TMap<FString, FString>	CodecOptions;
+
+	/** Size of each buffer the muxer output is collected in before a background thread writes it to disk. */
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite, Category = "Capture Configs|Output", meta = (ClampMin = "1", ClampMax = "256"))
+		int32	IOBufferSizeMB = 4;
+
+	/** Number of IO buffers, the muxer only waits for the disk when all of them are queued for writing. */
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite, Category = "Capture Configs|Output", meta = (ClampMin = "2", ClampMax = "64"))
+		int32	IOBufferCount = 4;
+
+	/** Write MP4 / MOV output as self-contained fragments: stopping no longer rewrites a large moov atom and a crashed capture stays playable up to its last fragment. */
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite, Category = "Capture Configs|Output")
+		bool	bFragmentedOutput = false;
+
+	/** Minimum fragment length in seconds, fragments always start on a keyframe so they are at least one GOP long. */
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite, Category = "Capture Configs|Output", meta = (ClampMin = "0", EditCondition = "bFragmentedOutput"))
+		float	FragmentDuration = 2.f;
+
+	/** Lower the bitrate (ABR) or raise CRF / QP while the encoder cannot keep up with the frame rate, and restore them once it can. */
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite, Category = "Capture Configs|Encoder")
+		bool	bAdaptiveEncoder = false;
+
+	/** How many quality steps the adaptive encoder may take below the configured settings. */
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite, Category = "Capture Configs|Encoder", meta = (ClampMin = "1", ClampMax = "6", EditCondition = "bAdaptiveEncoder"))
+		int32	AdaptiveEncoderMaxSteps = 4;
+
+	/** Split the capture into numbered files (Name_00000.mp4, ...) that each start on a keyframe and are finalized in the background while the next one records. */
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite, Category = "Capture Configs|Segments")
+		bool	bSegmentedOutput = false;
+
+	/** Start a new segment at the first keyframe after this many seconds, 0 disables the time limit. */
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite, Category = "Capture Configs|Segments", meta = (ClampMin = "0", EditCondition = "bSegmentedOutput"))
+		float	SegmentDuration = 600.f;
+
+	/** Start a new segment at the first keyframe once the current file reaches this size, 0 disables the size limit. */
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite, Category = "Capture Configs|Segments", meta = (ClampMin = "0", EditCondition = "bSegmentedOutput"))
+		int32	SegmentMaxSizeMB = 0;
+
+	/** Also keep an HLS playlist (Name.m3u8) of the finalized segments next to them. Playable as a stream with an .ts filename. */
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite, Category = "Capture Configs|Segments", meta = (EditCondition = "bSegmentedOutput"))
+		bool	bWriteSegmentPlaylist = false;
+
+	/** Keep the last ReplayDuration seconds of encoded audio and video in memory instead of writing a file, SaveReplay() writes them out. The StartCapture filename then only picks the container and codecs. */
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite, Category = "Capture Configs|Replay")
+		bool	bReplayBuffer = false;
+
+	/** Seconds of replay kept, rounded up to whole GOPs. */
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite, Category = "Capture Configs|Replay", meta = (ClampMin = "1", EditCondition = "bReplayBuffer"))
+		float	ReplayDuration = 60.f;
+
+	/** Upper bound of the replay memory, the oldest GOPs are dropped early when the encoded stream is larger than expected. */
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite, Category = "Capture Configs|Replay", meta = (ClampMin = "1", EditCondition = "bReplayBuffer"))
+		int32	ReplayMaxMemoryMB = 512;
+
+	/** Seconds between two OnCaptureStatsUpdated broadcasts while capturing, 0 disables them. GetCaptureStats() works either way. */
+	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite, Category = "Capture Configs|Telemetry", meta = (ClampMin = "0"))
+		float	StatsInterval = 0.f;
+};
+
+/** Live numbers of a running capture, e.g. to lower the capture resolution while the encoder cannot keep up. */
+USTRUCT(BlueprintType)
+struct FCaptureStats
+{
+	GENERATED_USTRUCT_BODY()
+public:
+
+	/** Frames encoded per second, over the last second. */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Capture Stats")
+		float	EncodeFps = 0.f;
+
+	/** Time from capturing a frame to having it encoded, averaged since StartCapture. */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Capture Stats")
+		float	AverageEncodeLatencyMs = 0.f;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Capture Stats")
+		float	MaxEncodeLatencyMs = 0.f;
+
+	/** Captured frames waiting for the encoder. */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Capture Stats")
+		int32	QueueDepth = 0;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Capture Stats")
+		int32	EncodedFrames = 0;
+
+	/** Frames not recorded because the encoder fell behind. */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Capture Stats")
+		int32	DroppedFrames = 0;
+
+	/** Frames identical to the previous one, repeated or extended instead of converted again (see bElideStaticFrames). */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Capture Stats")
+		int32	DuplicatedFrames = 0;
+
+	/** Encoded audio and video handed to the muxer, or to the replay buffer. */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Capture Stats")
+		int64	BytesWritten = 0;
+
+	/** Output bitrate over the last second. */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Capture Stats")
+		float	BitrateKbps = 0.f;
+
+	/** Submix audio waiting for the audio encoder. */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Capture Stats")
+		float	AudioBacklogMs = 0.f;
+
+	/** Audio frames lost because the audio encoder fell behind. */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Capture Stats")
+		int32	DroppedAudioFrames = 0;
 };
+
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FOnCaptureStatsUpdated, const FCaptureStats&, Stats);
@@ -8,8 +8,44 @@
 #include "Widgets/SWindow.h"
 #include <chrono>
 #include "AudioDevice.h"
+#include "HAL/ThreadSafeBool.h"
+#include "HAL/ThreadSafeCounter.h"
+#include "HAL/ThreadSafeCounter64.h"
+#include "CaptureRingBuffer.h"
+#include "VideoCaptureTelemetry.h"
+#include "Async/Future.h"
 #include "VideoCaptureSubsystem.generated.h"
 
+enum class ECaptureReadbackState : uint8
+{
+	/** Ready to receive the next back buffer copy */
+	Free,
+	/** Waiting for its GPU copy to finish */
+	Copying,
+	/** Mapped and read in place by the encoder thread */
+	Encoding,
+};
+
+/** One staging texture of the readback ring and the fence that tells when its copy has landed. */
+struct FCaptureReadbackSlot
+{
+	FTexture2DRHIRef Texture;
+	FGPUFenceRHIRef Fence;
+	int32 FrameNumber = INDEX_NONE;
+
+	/** FPlatformTime::Cycles64() when the back buffer was taken. */
+	uint64 CaptureCycles = 0;
+
+	ECaptureReadbackState State = ECaptureReadbackState::Free;
+
+	/** Set by the encoder thread once it no longer reads the mapped surface, the render thread unmaps it afterwards */
+	FThreadSafeBool bEncoded;
+};
+
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FOnReplaySaved, const FString&, Filename, bool, bSuccess);
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FOnCaptureStarted, const FString&, Filename, bool, bSuccess);
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_ThreeParams(FOnCaptureFinalized, const FString&, Filename, bool, bSuccess, const FCaptureStats&, Stats);
+
 /**
  * 
  */
@@ -24,38 +60,149 @@ public:
 
 	virtual void OnNewSubmixBuffer(const USoundSubmix* OwningSubmix, float* AudioData, int32 NumSamples, int32 NumChannels, const int32 SampleRate, double AudioClock);
 
+	/**
+	 * Returns right away: the file, codecs, header and encoder threads are set up on a background thread and
+	 * OnCaptureStarted fires on the game thread once recording begins, or failed. Frames rendered before that are not
+	 * recorded, the capture clock starts with the first one after it.
+	 */
 	UFUNCTION(BlueprintCallable, Category = "Video Capture")
 	void StartCapture(const FString& InVideoFilename, const FCaptureConfigs& InConfigs);
 
 	UFUNCTION(BlueprintPure, Category = "Video Capture")
 	bool IsInitialized();
 
+	/**
+	 * Detaches from the back buffer and the submix right away and records nothing after it. Flushing the encoder, the
+	 * trailer and the teardown run on a background thread, OnCaptureFinalized fires on the game thread once the file
+	 * is complete. Also cancels a StartCapture() still in progress, waiting for its background work first.
+	 */
 	UFUNCTION(BlueprintCallable, Category = "Video Capture")
 	void StopCapture();
 
+	/** Number of captured frames waiting for the encoder thread. */
+	UFUNCTION(BlueprintPure, Category = "Video Capture")
+	int32 GetEncodeQueueDepth() const;
+
+	/** Cheap snapshot of the running capture, or of the last one once stopped. Lock free, game thread. */
+	UFUNCTION(BlueprintPure, Category = "Video Capture")
+	FCaptureStats GetCaptureStats() const;
+
+	/** Frames found identical to the previous one and not converted since StartCapture, see bElideStaticFrames. */
+	UFUNCTION(BlueprintPure, Category = "Video Capture")
+	int32 GetElidedFrameCount() const;
+
+	/** Time the audio mixer spent in the capture's submix callback since StartCapture. */
+	UFUNCTION(BlueprintPure, Category = "Video Capture")
+	void GetAudioCallbackTiming(float& AverageMs, float& MaxMs) const;
+
+	/**
+	 * Replay captures only. Writes the buffered replay into Filename on a background thread without re-encoding,
+	 * OnReplaySaved fires once it is done. Returns false if there is no replay buffer or a save is still running.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Video Capture")
+	bool SaveReplay(const FString& Filename);
+
+	/** How much the replay buffer currently holds. */
+	UFUNCTION(BlueprintPure, Category = "Video Capture")
+	void GetReplayBufferUsage(float& BufferedSeconds, float& BufferedMB) const;
+
 protected:
 
-	bool InitReadbackTexture();
+	/** Enqueues the creation of the readback textures on the render thread, the future tells whether all of them were created. */
+	TFuture<bool> InitReadbackTextures();
+
+	/** Background start. Opens the file, codecs and muxer and starts the encoder threads, the game thread does not touch any of it meanwhile. */
+	bool OpenPipeline(const struct FCaptureVideoSettings& VideoSettings);
+
+	/** Game thread ticker, finishes the capture start once OpenPipeline() is done. */
+	bool PollCaptureStart(float DeltaTime);
+
+	/** Game thread. Starts the capture clock and hooks the back buffer and the submix. */
+	void BeginCapturing();
+
+	/** Background stop. Drains the encoders and writes the file out, false if it could not be completed. */
+	bool FinalizePipeline();
+
+	/** Game thread ticker, finishes the capture stop once FinalizePipeline() is done. */
+	bool PollCaptureFinalize(float DeltaTime);
+
+	/** Blocks until a capture being finalized is done, for a new StartCapture() and Deinitialize(). */
+	void WaitForFinalize();
+
+	/** Game thread. Releases what only the game and render threads may touch and fires OnCaptureFinalized. */
+	void FinishFinalize();
+
+	/** True while a background start or stop owns the encoders, muxer and buffers. */
+	bool IsPipelineInBackground() const;
+
+	/** Enqueues handing the readbacks still in flight to the encoder, the future is set once the render thread has done it. */
+	TFuture<void> FlushPendingReadbacks();
+
+	/** Enqueues unmapping and releasing the readback textures on the render thread, nothing waits for it. */
+	void ReleaseReadbackTextures();
 
 	bool FindViewportWindow();
 
 	bool CreateVideoFileWriter();
 
-	void DestroyVideoFileWriter();
+	/** Creates the audio stream and encoder. */
+	bool InitAudioEncoder();
+
+	/** Locks the engine to a 1 / FrameRate timestep for offline captures, RestoreFixedTimestep() puts the previous one back. */
+	void ApplyFixedTimestep();
+
+	void RestoreFixedTimestep();
+
+	/** Ticker callback broadcasting OnCaptureStatsUpdated every CaptureConfigs.StatsInterval. */
+	bool BroadcastCaptureStats(float DeltaTime);
+
+	/** Waits for a running SaveReplay() and frees the replay buffer. */
+	void DestroyReplayBuffer();
+
+	/** Hands an encoded packet to the muxer, or to the replay buffer. Takes over the packet's data. */
+	void SubmitPacket(struct AVPacket* InPacket);
 
-	void ReleaseContext();
+	/** Returns false if the file could not be written completely. */
+	bool DestroyVideoFileWriter();
 
-	void WriteFrameToFile(const TArray<FColor>& ColorBuffer, int32 CurrentFrame);
+	bool StartEncoderThread();
 
-	void EncodeVideoFrame(struct AVCodecContext* InCodecCtx, struct AVFrame* InFrame, struct AVPacket* InPacket);
+	void StopEncoderThread();
+
+	void StopAudioEncoderThread();
+
+	/** Blocks until no submix callback is running. The listener must already be detached. */
+	void WaitForAudioCallbacks();
+
+	/** Flushes the encoder, writes the trailer and frees the codecs. False if the output could not be completed. */
+	bool ReleaseContext();
+
+	/** Encoder thread. Frame index, or the capture time in 1 / VariableFrameRateClock units for variable frame rate captures. */
+	int64 GetFramePts(const struct FCapturedVideoFrame& CapturedFrame);
+
+	/** Encoder thread. Moves a packet of the video encoder into the stream time base and submits it. */
+	void OnVideoPacket(struct AVPacket* InPacket);
 
 	void OnBackBufferReady_RenderThread(SWindow& SlateWindow, const FTexture2DRHIRef& BackBuffer);
 
-	void InitAvailableEvent();
+	void ResolveRenderTarget(const FTexture2DRHIRef& SourceBackBuffer, FCaptureReadbackSlot& Slot);
 
-	void BlockUntilAvailable();
+	/** Hands the readbacks whose copies have finished to the encoder, oldest first. The first MinReadbacks are waited for even if their fences have not signalled yet. */
+	void ProcessPendingReadbacks_RenderThread(int32 MinReadbacks);
 
-	void ResolveRenderTarget(const FTexture2DRHIRef& SourceBackBuffer);
+	/** Unmaps the staging surfaces the encoder thread has finished reading. */
+	void UnmapEncodedReadbacks_RenderThread();
+
+	int32 FindFreeReadbackSlot() const;
+
+	/** Audio encoder thread. Moves the samples written by the submix callback into AudioFrame and encodes every frame filled. */
+	void EncodePendingAudio();
+
+	/** Audio encoder thread. Hands every buffered submix sample to the resampler. */
+	void QueuePendingAudioForResampling();
+
+	/** Encodes the planar samples in AudioFrame. */
+	void EncodeAudioFrame();
 
 	struct AVFrame* AllocAudioFrame(enum AVSampleFormat Format, uint64 ChannelLayout, int32 SampleRate, int32 SamplesCount);
 
@@ -67,6 +214,21 @@ public:
 	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, Category = "Video Capture")
 	FCaptureConfigs	CaptureConfigs;
 
+	UPROPERTY(BlueprintAssignable, Category = "Video Capture")
+	FOnReplaySaved OnReplaySaved;
+
+	/** Fires once per StartCapture() that got past its synchronous checks, with whether the capture is now recording. */
+	UPROPERTY(BlueprintAssignable, Category = "Video Capture")
+	FOnCaptureStarted OnCaptureStarted;
+
+	/** Fires once the file of a stopped capture is complete, with the stats of the whole capture. */
+	UPROPERTY(BlueprintAssignable, Category = "Video Capture")
+	FOnCaptureFinalized OnCaptureFinalized;
+
+	/** Fires every CaptureConfigs.StatsInterval seconds while capturing. */
+	UPROPERTY(BlueprintAssignable, Category = "Video Capture")
+	FOnCaptureStatsUpdated OnCaptureStatsUpdated;
+
 	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Video Capture")
 	int32 CapturedFrameNumber = 0;
 
@@ -74,34 +236,105 @@ public:
 
 	FIntPoint ViewportSize;
 
-	/** Texture used to store the resolved render target */
-	FTexture2DRHIRef ReadbackTexture;
-
 private:
 
 	struct AVFormatContext* FormatCtx;
-	struct AVCodec* Codec;
-	struct AVCodecContext* CodecCtx;
-	struct AVFrame* Frame;
-	struct AVPacket* Packet;
 	struct AVStream* Stream;
 
+	class FCaptureVideoEncoder* VideoEncoder;
+
 	struct AVStream* AudioStream;
 	struct AVCodec* AudioCodec;
 	struct AVCodecContext* AudioCodecCtx;
 	struct AVFrame* AudioFrame;
-	struct AVFrame* AudioTempFrame;
-	struct SwrContext* AudioSwrCtx = nullptr;
+	struct AVFrame* AudioResampleFrame;
+	struct SwrContext* AudioSwrCtx;
+
+	/** Samples already in AudioFrame, audio encoder thread only. */
+	int32 AudioFrameFill;
+
+	class FVideoCaptureFileWriter* Writer;
+
+	class FVideoCaptureEncoderThread* EncoderThread;
+	class FVideoEncoderGovernor* EncoderGovernor;
+	class FVideoCaptureMuxerThread* MuxerThread;
+	class FVideoCaptureAudioEncoderThread* AudioEncoderThread;
+	class FVideoCaptureReplayBuffer* ReplayBuffer;
+	class FVideoCaptureSegmentWriter* SegmentWriter;
+
+	TFuture<bool> ReplaySaveTask;
 
-	FArchive* Writer;
+	/** OpenPipeline() running in the background, polled by StartTickerHandle. */
+	TFuture<bool> StartTask;
+	FDelegateHandle StartTickerHandle;
+	double StartRequestTime;
+
+	/** StopCapture() during a background start, PollCaptureStart() tears the pipeline down instead of capturing. */
+	bool bCancelStart;
+
+	/** FinalizePipeline() running in the background, polled by FinalizeTickerHandle. */
+	TFuture<bool> FinalizeTask;
+	FDelegateHandle FinalizeTickerHandle;
+	double StopRequestTime;
+
+	/** False for starts that failed or were cancelled, they never recorded anything to report. */
+	bool bBroadcastFinalize;
 
 	std::chrono::steady_clock::time_point PreFrameCaptureTime;
 	std::chrono::nanoseconds CaptureFrameInterval;
 
+	bool bFixedTimestepApplied;
+	bool bSavedUseFixedTimeStep;
+	double SavedFixedDeltaTime;
+
 	void* ViewportWindow;
 	FDelegateHandle BackBufferHandle;
+	FDelegateHandle StatsTickerHandle;
+
+	/** Ring of staging textures used to store the resolved render target, only touched on the render thread after creation */
+	TArray<FCaptureReadbackSlot> ReadbackSlots;
+
+	/** Slots waiting for their GPU copy, oldest first */
+	TArray<int32, TInlineAllocator<8>> CopyingSlots;
+
+	/** The audio encoder is always stereo. */
+	static constexpr int32 AudioEncoderChannels = 2;
+
+	/** One plane per encoder channel, written by the submix callback and read by the audio encoder thread. */
+	TCaptureRingBuffer<float> AudioRingBuffer;
+
+	/** Set while the submix listener is registered, late callbacks after StopCapture see it cleared and return */
+	FThreadSafeBool bAudioAttached;
+
+	/** Submix callbacks currently running, the audio encoder thread and rings are only freed once this drops to zero */
+	FThreadSafeCounter AudioCallbacksInFlight;
+
+	FThreadSafeCounter64 AudioCallbackCount;
+	FThreadSafeCounter64 AudioCallbackCycles;
+	FThreadSafeCounter64 AudioCallbackMaxCycles;
+	FThreadSafeCounter AudioDroppedFrames;
+	int64 AudioSampleCount;
+
+	/** Rate of the samples in AudioRingBuffer. */
+	int32 AudioSubmixSampleRate;
+
+	/** Start of the capture clock, video and audio timestamps of variable frame rate captures are relative to it. */
+	uint64 CaptureStartCycles;
+
+	/** When the first submix buffer started playing, 0 until then. */
+	FThreadSafeCounter64 AudioStartCycles;
+
+	/** Audio encoder thread, set until the first audio frame is placed on the capture clock. */
+	bool bAlignAudioClock;
+
+	/** Encoder thread. */
+	int64 LastVideoPts;
+
+	/** Elided frames of the last capture, kept once its encoder is gone. */
+	int32 ElidedFrameCount;
+
+	/** Dropped frames of the last capture, kept once its encoder thread is gone. */
+	int32 DroppedFrameCount;
 
-	FEvent* AvailableEvent;
-	TArray<uint8> AudioSubmixBuffer;
-	int32 AudioSampleCount;
+	FVideoCaptureTelemetry Telemetry;
 };
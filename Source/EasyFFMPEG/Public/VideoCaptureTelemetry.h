@@ -0,0 +1,90 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/ThreadSafeCounter64.h"
+#include "VideoCaptureStructures.h"
+
+/**
+ * Running numbers behind FCaptureStats, written by the encoder threads and read from any thread without a lock. Every
+ * value is its own atomic, so a snapshot may straddle two frames but never holds up the encoder.
+ */
+class FVideoCaptureTelemetry
+{
+public:
+	/** Needs the encoder threads idle. */
+	void Reset()
+	{
+		EncodedFrames.Reset();
+		LatencyCycles.Reset();
+		MaxLatencyCycles.Reset();
+		BytesWritten.Reset();
+		EncodeMilliFps.Reset();
+		BitsPerSecond.Reset();
+
+		WindowStartCycles = 0;
+		WindowFrames = 0;
+		WindowBytes = 0;
+	}
+
+	/** Video encoder thread, once per encoded frame. Also refreshes the per second rates. */
+	void AddEncodedFrame(uint64 InLatencyCycles)
+	{
+		const int64 Frames = EncodedFrames.Increment();
+		LatencyCycles.Add(int64(InLatencyCycles));
+		if (int64(InLatencyCycles) > MaxLatencyCycles.GetValue()) {
+			MaxLatencyCycles.Set(int64(InLatencyCycles));
+		}
+
+		const uint64 NowCycles = FPlatformTime::Cycles64();
+		if (WindowStartCycles == 0) {
+			WindowStartCycles = NowCycles;
+			return;
+		}
+
+		const double WindowSeconds = FPlatformTime::ToSeconds64(NowCycles - WindowStartCycles);
+		if (WindowSeconds >= RateWindowSeconds) {
+			const int64 Bytes = BytesWritten.GetValue();
+			EncodeMilliFps.Set(int64((Frames - WindowFrames) * 1000 / WindowSeconds));
+			BitsPerSecond.Set(int64((Bytes - WindowBytes) * 8 / WindowSeconds));
+
+			WindowStartCycles = NowCycles;
+			WindowFrames = Frames;
+			WindowBytes = Bytes;
+		}
+	}
+
+	/** Any thread, for every encoded audio or video packet. */
+	void AddBytes(int64 Bytes) { BytesWritten.Add(Bytes); }
+
+	/** Fills in the encoder side of OutStats, the owner adds queue, drop and audio numbers. */
+	void GetStats(FCaptureStats& OutStats) const
+	{
+		const int64 Frames = EncodedFrames.GetValue();
+
+		OutStats.EncodeFps = EncodeMilliFps.GetValue() / 1000.f;
+		OutStats.AverageEncodeLatencyMs = Frames > 0 ? float(FPlatformTime::ToMilliseconds64(LatencyCycles.GetValue() / Frames)) : 0.f;
+		OutStats.MaxEncodeLatencyMs = float(FPlatformTime::ToMilliseconds64(MaxLatencyCycles.GetValue()));
+		OutStats.EncodedFrames = int32(Frames);
+		OutStats.BytesWritten = BytesWritten.GetValue();
+		OutStats.BitrateKbps = BitsPerSecond.GetValue() / 1000.f;
+	}
+
+private:
+	static constexpr double RateWindowSeconds = 1.0;
+
+	FThreadSafeCounter64 EncodedFrames;
+	FThreadSafeCounter64 LatencyCycles;
+	FThreadSafeCounter64 MaxLatencyCycles;
+	FThreadSafeCounter64 BytesWritten;
+
+	/** Rates over the last full window, published by AddEncodedFrame(). */
+	FThreadSafeCounter64 EncodeMilliFps;
+	FThreadSafeCounter64 BitsPerSecond;
+
+	/** Video encoder thread only. */
+	uint64 WindowStartCycles = 0;
+	int64 WindowFrames = 0;
+	int64 WindowBytes = 0;
+};
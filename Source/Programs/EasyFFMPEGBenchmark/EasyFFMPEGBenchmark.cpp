@@ -0,0 +1,596 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+// Headless throughput benchmark of the capture core: feeds synthetic BGRA frames through the same conversion, encode
+// and mux path the capture subsystem uses and prints one JSON document with fps, per stage latency and peak RSS.
+//
+// Usage: EasyFFMPEGBenchmark [--frames N] [--fps N] [--patterns static,noise,scroll] [--resolutions 720p,1080p,1440p,4k]
+//                            [--presets ultrafast,veryfast,medium] [--format I420|NV12] [--slices N] [--elide]
+//                            [--output-dir Dir] [--json File]
+
+
+#include "CaptureColorConversion.h"
+#include "CaptureFileMuxer.h"
+#include "CaptureVideoEncoder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+#include "libavformat/avformat.h"
+#include "libavutil/log.h"
+}
+
+typedef std::chrono::steady_clock FBenchmarkClock;
+
+struct FBenchmarkOptions
+{
+	int32_t FrameCount = 300;
+	int32_t FrameRate = 60;
+	std::vector<std::string> Patterns = { "static", "noise", "scroll" };
+	std::vector<std::string> Resolutions = { "720p", "1080p", "1440p", "4k" };
+	std::vector<std::string> Presets = { "ultrafast", "veryfast", "medium" };
+	AVPixelFormat PixelFormat = AV_PIX_FMT_YUV420P;
+	int32_t Slices = 4;
+	bool bElideStaticFrames = false;
+	std::string OutputDirectory = ".";
+	std::string JsonFilename;
+};
+
+/** Latencies of one stage over a run, in seconds. */
+struct FStageSamples
+{
+	std::vector<double> Samples;
+
+	double Percentile(double Fraction) const
+	{
+		if (Samples.empty()) {
+			return 0.0;
+		}
+
+		std::vector<double> Sorted = Samples;
+		std::sort(Sorted.begin(), Sorted.end());
+
+		const size_t Index = std::min(size_t(Fraction * double(Sorted.size())), Sorted.size() - 1);
+		return Sorted[Index];
+	}
+
+	double Max() const
+	{
+		return Samples.empty() ? 0.0 : *std::max_element(Samples.begin(), Samples.end());
+	}
+};
+
+struct FRunResult
+{
+	std::string Pattern;
+	std::string Preset;
+	int32_t Width = 0;
+	int32_t Height = 0;
+	bool bSucceeded = false;
+	int32_t Frames = 0;
+	double Seconds = 0.0;
+	int64_t Bytes = 0;
+	int32_t ElidedFrames = 0;
+	double PeakRSSMB = 0.0;
+
+	FStageSamples Hash;
+	FStageSamples Convert;
+	FStageSamples Encode;
+	FStageSamples Mux;
+	FStageSamples Total;
+};
+
+static std::vector<std::string> SplitList(const std::string& List)
+{
+	std::vector<std::string> Items;
+	std::stringstream Stream(List);
+	std::string Item;
+	while (std::getline(Stream, Item, ','))
+	{
+		if (!Item.empty()) {
+			Items.push_back(Item);
+		}
+	}
+
+	return Items;
+}
+
+static bool ParseResolution(const std::string& Name, int32_t& OutWidth, int32_t& OutHeight)
+{
+	if (Name == "720p") {
+		OutWidth = 1280;
+		OutHeight = 720;
+	}
+	else if (Name == "1080p") {
+		OutWidth = 1920;
+		OutHeight = 1080;
+	}
+	else if (Name == "1440p") {
+		OutWidth = 2560;
+		OutHeight = 1440;
+	}
+	else if (Name == "4k" || Name == "2160p") {
+		OutWidth = 3840;
+		OutHeight = 2160;
+	}
+	else if (sscanf(Name.c_str(), "%dx%d", &OutWidth, &OutHeight) != 2 || OutWidth <= 0 || OutHeight <= 0) {
+		return false;
+	}
+
+	return true;
+}
+
+static bool ParseOptions(int argc, char** argv, FBenchmarkOptions& Options)
+{
+	for (int32_t Index = 1; Index < argc; Index++)
+	{
+		const std::string Argument = argv[Index];
+		const bool bHasValue = Index + 1 < argc;
+
+		if (Argument == "--elide") {
+			Options.bElideStaticFrames = true;
+		}
+		else if (!bHasValue) {
+			return false;
+		}
+		else if (Argument == "--frames") {
+			Options.FrameCount = atoi(argv[++Index]);
+		}
+		else if (Argument == "--fps") {
+			Options.FrameRate = atoi(argv[++Index]);
+		}
+		else if (Argument == "--patterns") {
+			Options.Patterns = SplitList(argv[++Index]);
+		}
+		else if (Argument == "--resolutions") {
+			Options.Resolutions = SplitList(argv[++Index]);
+		}
+		else if (Argument == "--presets") {
+			Options.Presets = SplitList(argv[++Index]);
+		}
+		else if (Argument == "--format") {
+			Options.PixelFormat = strcmp(argv[++Index], "NV12") == 0 ? AV_PIX_FMT_NV12 : AV_PIX_FMT_YUV420P;
+		}
+		else if (Argument == "--slices") {
+			Options.Slices = atoi(argv[++Index]);
+		}
+		else if (Argument == "--output-dir") {
+			Options.OutputDirectory = argv[++Index];
+		}
+		else if (Argument == "--json") {
+			Options.JsonFilename = argv[++Index];
+		}
+		else {
+			return false;
+		}
+	}
+
+	return Options.FrameCount > 0 && Options.FrameRate > 0 && Options.Slices > 0;
+}
+
+/**
+ * Source frames of a pattern. "static" repeats one picture, "noise" is fresh random (incompressible) content every
+ * frame and "scroll" moves a detailed picture by a few pixels per frame. Producing a frame is not timed.
+ */
+class FPatternSource
+{
+public:
+	FPatternSource(const std::string& InPattern, int32_t InWidth, int32_t InHeight)
+		: Pattern(InPattern)
+		, Width(InWidth)
+		, Height(InHeight)
+		, Pitch(InWidth * 4)
+		, Random(0x2545F4914F6CDD1Dull)
+	{
+		// Scrolling reads a window of a picture twice as high.
+		Picture.resize(size_t(Pitch) * (Pattern == "scroll" ? Height * 2 : Height));
+
+		for (size_t Y = 0; Y < Picture.size() / Pitch; Y++)
+		{
+			uint8_t* Row = Picture.data() + Y * Pitch;
+			for (int32_t X = 0; X < Width; X++)
+			{
+				// Gradients with some edges, roughly what a game UI looks like to the encoder.
+				Row[X * 4 + 0] = uint8_t(X * 255 / Width);
+				Row[X * 4 + 1] = uint8_t((Y % Height) * 255 / Height);
+				Row[X * 4 + 2] = uint8_t(((X / 16) ^ (Y / 16)) & 1 ? 200 : 40);
+				Row[X * 4 + 3] = 255;
+			}
+		}
+	}
+
+	const uint8_t* GetFrame(int32_t Index)
+	{
+		if (Pattern == "noise") {
+			for (size_t Offset = 0; Offset + 8 <= Picture.size(); Offset += 8)
+			{
+				Random ^= Random << 13;
+				Random ^= Random >> 7;
+				Random ^= Random << 17;
+				memcpy(Picture.data() + Offset, &Random, 8);
+			}
+		}
+		else if (Pattern == "scroll") {
+			return Picture.data() + size_t((Index * ScrollSpeed) % Height) * Pitch;
+		}
+
+		return Picture.data();
+	}
+
+	int32_t GetPitch() const { return Pitch; }
+
+	bool IsValid() const { return Pattern == "static" || Pattern == "noise" || Pattern == "scroll"; }
+
+private:
+	static constexpr int32_t ScrollSpeed = 4;
+
+	const std::string Pattern;
+	const int32_t Width;
+	const int32_t Height;
+	const int32_t Pitch;
+
+	std::vector<uint8_t> Picture;
+	uint64_t Random;
+};
+
+static double Seconds(FBenchmarkClock::duration Duration)
+{
+	return std::chrono::duration<double>(Duration).count();
+}
+
+/** Restarts the kernel's high water mark of the resident set, so every run reports its own peak. Linux 4.0+. */
+static void ResetPeakRSS()
+{
+#if defined(__GLIBC__)
+	// glibc keeps the frame buffers of earlier runs in its heap, they would count toward every later run's peak.
+	malloc_trim(0);
+#endif
+
+	if (FILE* ClearRefs = fopen("/proc/self/clear_refs", "w")) {
+		fputs("5", ClearRefs);
+		fclose(ClearRefs);
+	}
+}
+
+static double GetPeakRSSMB()
+{
+	if (FILE* Status = fopen("/proc/self/status", "r")) {
+		char Line[256];
+		long PeakKB = -1;
+		while (fgets(Line, sizeof(Line), Status) != nullptr)
+		{
+			if (sscanf(Line, "VmHWM: %ld kB", &PeakKB) == 1) {
+				break;
+			}
+		}
+		fclose(Status);
+
+		if (PeakKB >= 0) {
+			return PeakKB / 1024.0;
+		}
+	}
+
+	// Peak of the whole process instead.
+	rusage Usage;
+	getrusage(RUSAGE_SELF, &Usage);
+	return Usage.ru_maxrss / 1024.0;
+}
+
+/**
+ * Stands in for the engine's task graph. The workers are started once per run and wait for the next batch in between,
+ * the calling thread takes tasks of its own batch too.
+ */
+class FWorkerPool
+{
+public:
+	explicit FWorkerPool(int32_t NumWorkers)
+	{
+		for (int32_t Worker = 0; Worker < NumWorkers; Worker++)
+		{
+			Workers.emplace_back(&FWorkerPool::WorkerLoop, this);
+		}
+	}
+
+	~FWorkerPool()
+	{
+		{
+			std::lock_guard<std::mutex> Lock(Mutex);
+			bStopping = true;
+		}
+		BatchStarted.notify_all();
+
+		for (std::thread& Worker : Workers)
+		{
+			Worker.join();
+		}
+	}
+
+	/** Only valid while the pool is alive. */
+	FCaptureParallelFor GetParallelFor()
+	{
+		return [this](int32_t NumTasks, const std::function<void(int32_t Task)>& Body)
+		{
+			ParallelFor(NumTasks, Body);
+		};
+	}
+
+private:
+	void ParallelFor(int32_t NumTasks, const std::function<void(int32_t Task)>& Body)
+	{
+		{
+			std::lock_guard<std::mutex> Lock(Mutex);
+			CurrentBody = &Body;
+			NextTask = 0;
+			TaskCount = NumTasks;
+			PendingTasks = NumTasks;
+			Batch++;
+		}
+		BatchStarted.notify_all();
+
+		RunTasks();
+
+		std::unique_lock<std::mutex> Lock(Mutex);
+		BatchDone.wait(Lock, [this]() { return PendingTasks == 0; });
+		CurrentBody = nullptr;
+	}
+
+	/** Takes tasks of the current batch until none is left. */
+	void RunTasks()
+	{
+		while (true)
+		{
+			const std::function<void(int32_t Task)>* Body = nullptr;
+			int32_t Task = 0;
+			{
+				std::lock_guard<std::mutex> Lock(Mutex);
+				if (CurrentBody == nullptr || NextTask >= TaskCount) {
+					return;
+				}
+				Body = CurrentBody;
+				Task = NextTask++;
+			}
+
+			(*Body)(Task);
+
+			std::lock_guard<std::mutex> Lock(Mutex);
+			if (--PendingTasks == 0) {
+				BatchDone.notify_all();
+			}
+		}
+	}
+
+	void WorkerLoop()
+	{
+		uint64_t SeenBatch = 0;
+		while (true)
+		{
+			{
+				std::unique_lock<std::mutex> Lock(Mutex);
+				BatchStarted.wait(Lock, [this, SeenBatch]() { return bStopping || Batch != SeenBatch; });
+				if (bStopping) {
+					return;
+				}
+				SeenBatch = Batch;
+			}
+
+			RunTasks();
+		}
+	}
+
+	std::vector<std::thread> Workers;
+
+	std::mutex Mutex;
+	std::condition_variable BatchStarted;
+	std::condition_variable BatchDone;
+
+	/** Guarded by Mutex. */
+	const std::function<void(int32_t Task)>* CurrentBody = nullptr;
+	int32_t NextTask = 0;
+	int32_t TaskCount = 0;
+	int32_t PendingTasks = 0;
+	uint64_t Batch = 0;
+	bool bStopping = false;
+};
+
+static FRunResult RunBenchmark(const FBenchmarkOptions& Options, const std::string& Pattern, const std::string& Resolution, const std::string& Preset)
+{
+	FRunResult Result;
+	Result.Pattern = Pattern;
+	Result.Preset = Preset;
+
+	if (!ParseResolution(Resolution, Result.Width, Result.Height)) {
+		fprintf(stderr, "Unknown resolution '%s'.\n", Resolution.c_str());
+		return Result;
+	}
+
+	FPatternSource Source(Pattern, Result.Width, Result.Height);
+	if (!Source.IsValid()) {
+		fprintf(stderr, "Unknown pattern '%s'.\n", Pattern.c_str());
+		return Result;
+	}
+
+	FCaptureVideoSettings Settings;
+	Settings.Width = Result.Width;
+	Settings.Height = Result.Height;
+	Settings.FrameRateNum = Options.FrameRate;
+	Settings.FrameRateDen = 1;
+	Settings.GopSize = Options.FrameRate;
+	Settings.PixelFormat = Options.PixelFormat;
+	Settings.ConversionSlices = Options.Slices;
+	Settings.bElideStaticFrames = Options.bElideStaticFrames;
+	Settings.Preset = Preset;
+	Settings.BitRate = int64_t(Result.Width) * Result.Height * Options.FrameRate / 10;
+
+	const std::string Filename = Options.OutputDirectory + "/EasyFFMPEGBenchmark.mp4";
+
+	ResetPeakRSS();
+
+	// Declared first so it outlives the encoder that uses it.
+	FWorkerPool WorkerPool(std::max(Options.Slices - 1, 0));
+	FCaptureFileMuxer Muxer;
+	FCaptureVideoEncoder Encoder;
+	int32_t StreamIndex = -1;
+
+	if (!Muxer.Create(Filename)) {
+		return Result;
+	}
+
+	const bool bOpened = Encoder.Open(Muxer.GetOutputFormat(), Settings,
+		[&Muxer, &Encoder, &StreamIndex, &Result](AVPacket* Packet)
+		{
+			Result.Bytes += Packet->size;
+			Muxer.WritePacket(Packet, StreamIndex, Encoder.GetCodecContext()->time_base);
+		},
+		WorkerPool.GetParallelFor());
+	if (!bOpened) {
+		return Result;
+	}
+
+	StreamIndex = Muxer.AddStream(Encoder.GetCodecContext());
+	if (StreamIndex < 0 || !Muxer.Start(nullptr, nullptr)) {
+		return Result;
+	}
+
+	for (int32_t Index = 0; Index < Options.FrameCount; Index++)
+	{
+		const uint8_t* Frame = Source.GetFrame(Index);
+
+		const FBenchmarkClock::time_point FrameStart = FBenchmarkClock::now();
+
+		if (!Encoder.EncodeBGRA(Frame, Source.GetPitch(), Index)) {
+			return Result;
+		}
+
+		const FCaptureFrameTiming& Timing = Encoder.GetLastFrameTiming();
+		Result.Hash.Samples.push_back(Timing.Hash);
+		Result.Convert.Samples.push_back(Timing.Convert);
+		Result.Encode.Samples.push_back(Timing.Encode);
+		Result.Mux.Samples.push_back(Timing.Packets);
+		Result.Total.Samples.push_back(Seconds(FBenchmarkClock::now() - FrameStart));
+		Result.Seconds += Result.Total.Samples.back();
+	}
+
+	// The frames still in the encoder's lookahead are part of the sustained rate.
+	const FBenchmarkClock::time_point FlushStart = FBenchmarkClock::now();
+
+	Encoder.Flush();
+	const bool bFinished = Muxer.Finish();
+
+	Result.Seconds += Seconds(FBenchmarkClock::now() - FlushStart);
+	Result.Frames = Options.FrameCount;
+	Result.ElidedFrames = Encoder.GetElidedFrameCount();
+	Result.PeakRSSMB = GetPeakRSSMB();
+	Result.bSucceeded = bFinished;
+
+	remove(Filename.c_str());
+
+	return Result;
+}
+
+static void WriteStage(std::ostream& Json, const char* Name, const FStageSamples& Stage, bool bLast)
+{
+	Json << "\t\t\t\t\"" << Name << "\": { \"p50_ms\": " << Stage.Percentile(0.5) * 1000.0
+		<< ", \"p99_ms\": " << Stage.Percentile(0.99) * 1000.0
+		<< ", \"max_ms\": " << Stage.Max() * 1000.0 << " }" << (bLast ? "\n" : ",\n");
+}
+
+static void WriteJson(std::ostream& Json, const FBenchmarkOptions& Options, const std::vector<FRunResult>& Results)
+{
+	Json.setf(std::ios::fixed);
+	Json.precision(3);
+
+	Json << "{\n";
+	Json << "\t\"kernel\": \"" << CaptureColorConversion::GetKernelName() << "\",\n";
+	Json << "\t\"pixel_format\": \"" << (Options.PixelFormat == AV_PIX_FMT_NV12 ? "NV12" : "I420") << "\",\n";
+	Json << "\t\"slices\": " << Options.Slices << ",\n";
+	Json << "\t\"elide_static_frames\": " << (Options.bElideStaticFrames ? "true" : "false") << ",\n";
+	Json << "\t\"frame_rate\": " << Options.FrameRate << ",\n";
+	Json << "\t\"runs\": [\n";
+
+	for (size_t Index = 0; Index < Results.size(); Index++)
+	{
+		const FRunResult& Result = Results[Index];
+
+		Json << "\t\t{\n";
+		Json << "\t\t\t\"pattern\": \"" << Result.Pattern << "\",\n";
+		Json << "\t\t\t\"width\": " << Result.Width << ",\n";
+		Json << "\t\t\t\"height\": " << Result.Height << ",\n";
+		Json << "\t\t\t\"preset\": \"" << Result.Preset << "\",\n";
+		Json << "\t\t\t\"succeeded\": " << (Result.bSucceeded ? "true" : "false") << ",\n";
+		Json << "\t\t\t\"frames\": " << Result.Frames << ",\n";
+		Json << "\t\t\t\"elided_frames\": " << Result.ElidedFrames << ",\n";
+		Json << "\t\t\t\"seconds\": " << Result.Seconds << ",\n";
+		Json << "\t\t\t\"fps\": " << (Result.Seconds > 0.0 ? Result.Frames / Result.Seconds : 0.0) << ",\n";
+		Json << "\t\t\t\"bytes\": " << Result.Bytes << ",\n";
+		Json << "\t\t\t\"peak_rss_mb\": " << Result.PeakRSSMB << ",\n";
+		Json << "\t\t\t\"stages\": {\n";
+		WriteStage(Json, "hash", Result.Hash, false);
+		WriteStage(Json, "convert", Result.Convert, false);
+		WriteStage(Json, "encode", Result.Encode, false);
+		WriteStage(Json, "mux", Result.Mux, false);
+		WriteStage(Json, "total", Result.Total, true);
+		Json << "\t\t\t}\n";
+		Json << "\t\t}" << (Index + 1 < Results.size() ? ",\n" : "\n");
+	}
+
+	Json << "\t]\n";
+	Json << "}\n";
+}
+
+int main(int argc, char** argv)
+{
+	FBenchmarkOptions Options;
+	if (!ParseOptions(argc, argv, Options)) {
+		fprintf(stderr, "Usage: EasyFFMPEGBenchmark [--frames N] [--fps N] [--patterns static,noise,scroll] [--resolutions 720p,1080p,1440p,4k|WxH]\n"
+			"                           [--presets ultrafast,veryfast,medium] [--format I420|NV12] [--slices N] [--elide]\n"
+			"                           [--output-dir Dir] [--json File]\n");
+		return 2;
+	}
+
+	// Keep stdout for the JSON.
+	av_log_set_level(AV_LOG_ERROR);
+
+	std::vector<FRunResult> Results;
+	bool bAllSucceeded = true;
+
+	for (const std::string& Resolution : Options.Resolutions)
+	{
+		for (const std::string& Pattern : Options.Patterns)
+		{
+			for (const std::string& Preset : Options.Presets)
+			{
+				fprintf(stderr, "%s %s %s...\n", Resolution.c_str(), Pattern.c_str(), Preset.c_str());
+
+				Results.push_back(RunBenchmark(Options, Pattern, Resolution, Preset));
+				bAllSucceeded &= Results.back().bSucceeded;
+			}
+		}
+	}
+
+	if (Options.JsonFilename.empty()) {
+		WriteJson(std::cout, Options, Results);
+	}
+	else {
+		std::ofstream JsonFile(Options.JsonFilename);
+		WriteJson(JsonFile, Options, Results);
+	}
+
+	return bAllSucceeded ? 0 : 1;
+}
@@ -0,0 +1,199 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+// Headless check of the capture core, no engine involved: converts with every kernel, then encodes synthetic frames
+// into a file and reads it back. Usage: EasyFFMPEGCoreTest [OutputDirectory]
+
+
+#include "CaptureColorConversion.h"
+#include "CaptureFileMuxer.h"
+#include "CaptureVideoEncoder.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+extern "C" {
+#include "libavcodec/avcodec.h"
+#include "libavformat/avformat.h"
+#include "libavutil/imgutils.h"
+#include "libavutil/pixdesc.h"
+}
+
+static int32_t FailureCount = 0;
+
+static void Check(bool bCondition, const char* What)
+{
+	if (!bCondition) {
+		fprintf(stderr, "FAILED: %s\n", What);
+		FailureCount++;
+	}
+}
+
+/** A gradient that moves with Index, Index < 0 gives the same picture every time. */
+static void FillFrame(std::vector<uint8_t>& Pixels, int32_t Width, int32_t Height, int32_t Index)
+{
+	const int32_t Offset = Index < 0 ? 0 : Index * 3;
+
+	for (int32_t Y = 0; Y < Height; Y++)
+	{
+		for (int32_t X = 0; X < Width; X++)
+		{
+			uint8_t* Pixel = &Pixels[(Y * Width + X) * 4];
+			Pixel[0] = uint8_t(X + Offset);
+			Pixel[1] = uint8_t(Y + Offset);
+			Pixel[2] = uint8_t(X ^ Y);
+			Pixel[3] = 255;
+		}
+	}
+}
+
+/** Compares only the visible bytes of every plane, the row padding of av_image_alloc is never written. */
+static bool PlanesMatch(uint8_t* const A[4], const int32_t APitch[4], uint8_t* const B[4], const int32_t BPitch[4], int32_t Width, int32_t Height, AVPixelFormat Format)
+{
+	const AVPixFmtDescriptor* Desc = av_pix_fmt_desc_get(Format);
+
+	for (int32_t Plane = 0; Plane < 4 && A[Plane] != nullptr; Plane++)
+	{
+		const int32_t RowBytes = av_image_get_linesize(Format, Width, Plane);
+		const int32_t Rows = Plane == 1 || Plane == 2 ? AV_CEIL_RSHIFT(Height, Desc->log2_chroma_h) : Height;
+
+		for (int32_t Y = 0; Y < Rows; Y++)
+		{
+			if (memcmp(A[Plane] + Y * APitch[Plane], B[Plane] + Y * BPitch[Plane], RowBytes) != 0) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+static void TestKernelsMatch(AVPixelFormat Format)
+{
+	// Odd sizes so every kernel also runs its scalar tail.
+	const int32_t Width = 333;
+	const int32_t Height = 187;
+
+	std::vector<uint8_t> Source(Width * Height * 4);
+	FillFrame(Source, Width, Height, 7);
+
+	uint8_t* Reference[4] = { nullptr };
+	uint8_t* Output[4] = { nullptr };
+	int32_t ReferencePitch[4] = { 0 };
+	int32_t OutputPitch[4] = { 0 };
+	av_image_alloc(Reference, ReferencePitch, Width, Height, Format, 32);
+	const int32_t FrameBytes = av_image_alloc(Output, OutputPitch, Width, Height, Format, 32);
+
+	Check(CaptureColorConversion::ConvertBGRAToYUVWithKernel("Scalar", Source.data(), Width * 4, Width, Height, Reference, ReferencePitch, Format, AVCOL_SPC_BT709, false), "Scalar reference");
+
+	for (const char* Kernel : CaptureColorConversion::GetAvailableKernels())
+	{
+		memset(Output[0], 0, FrameBytes);
+		Check(CaptureColorConversion::ConvertBGRAToYUVWithKernel(Kernel, Source.data(), Width * 4, Width, Height, Output, OutputPitch, Format, AVCOL_SPC_BT709, false, 4), Kernel);
+		Check(PlanesMatch(Reference, ReferencePitch, Output, OutputPitch, Width, Height, Format), Kernel);
+	}
+
+	av_freep(&Reference[0]);
+	av_freep(&Output[0]);
+}
+
+/** Encodes FrameCount frames, the second half static, and returns the number of video packets read back from Filename. */
+static int32_t EncodeAndCount(const std::string& Filename, const FCaptureVideoSettings& Settings, int32_t FrameCount, int32_t& OutElidedFrames)
+{
+	FCaptureFileMuxer Muxer;
+	FCaptureVideoEncoder Encoder;
+
+	if (!Muxer.Create(Filename)) {
+		return -1;
+	}
+
+	int32_t StreamIndex = -1;
+	const bool bOpened = Encoder.Open(Muxer.GetOutputFormat(), Settings,
+		[&Muxer, &Encoder, &StreamIndex](AVPacket* Packet)
+		{
+			Muxer.WritePacket(Packet, StreamIndex, Encoder.GetCodecContext()->time_base);
+		});
+	if (!bOpened) {
+		return -1;
+	}
+
+	StreamIndex = Muxer.AddStream(Encoder.GetCodecContext());
+	if (StreamIndex < 0 || !Muxer.Start(nullptr, nullptr)) {
+		return -1;
+	}
+
+	std::vector<uint8_t> Pixels(Settings.Width * Settings.Height * 4);
+	for (int32_t Index = 0; Index < FrameCount; Index++)
+	{
+		FillFrame(Pixels, Settings.Width, Settings.Height, Index < FrameCount / 2 ? Index : -1);
+
+		const int64_t Pts = Settings.VariableFrameRateClock > 0 ? int64_t(Index) * Settings.VariableFrameRateClock * Settings.FrameRateDen / Settings.FrameRateNum : Index;
+		Check(Encoder.EncodeBGRA(Pixels.data(), Settings.Width * 4, Pts), "EncodeBGRA");
+	}
+
+	Encoder.Flush();
+	OutElidedFrames = Encoder.GetElidedFrameCount();
+
+	if (!Muxer.Finish()) {
+		return -1;
+	}
+
+	AVFormatContext* InputCtx = nullptr;
+	if (avformat_open_input(&InputCtx, Filename.c_str(), nullptr, nullptr) < 0) {
+		return -1;
+	}
+
+	int32_t PacketCount = 0;
+	AVPacket* Packet = av_packet_alloc();
+	while (av_read_frame(InputCtx, Packet) >= 0)
+	{
+		if (InputCtx->streams[Packet->stream_index]->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) {
+			PacketCount++;
+		}
+		av_packet_unref(Packet);
+	}
+
+	av_packet_free(&Packet);
+	avformat_close_input(&InputCtx);
+
+	return PacketCount;
+}
+
+int main(int argc, char** argv)
+{
+	const std::string OutputDirectory = argc > 1 ? argv[1] : ".";
+
+	printf("Conversion kernel: %s\n", CaptureColorConversion::GetKernelName());
+
+	TestKernelsMatch(AV_PIX_FMT_YUV420P);
+	TestKernelsMatch(AV_PIX_FMT_NV12);
+
+	FCaptureVideoSettings Settings;
+	Settings.Width = 320;
+	Settings.Height = 180;
+	Settings.Preset = "ultrafast";
+	Settings.ConversionSlices = 2;
+	Settings.bElideStaticFrames = true;
+
+	const int32_t FrameCount = 60;
+	int32_t ElidedFrames = 0;
+
+	// Constant frame rate: static frames are still encoded, just not converted again.
+	const int32_t ConstantPackets = EncodeAndCount(OutputDirectory + "/EasyFFMPEGCoreTest_CFR.mp4", Settings, FrameCount, ElidedFrames);
+	Check(ConstantPackets == FrameCount, "every constant frame rate frame is in the file");
+	Check(ElidedFrames == FrameCount / 2 - 1, "constant frame rate static frames were elided");
+
+	// Variable frame rate: the static run collapses into its first frame plus the closing one.
+	Settings.VariableFrameRateClock = 90000;
+	Settings.PixelFormat = AV_PIX_FMT_NV12;
+	const int32_t VariablePackets = EncodeAndCount(OutputDirectory + "/EasyFFMPEGCoreTest_VFR.mkv", Settings, FrameCount, ElidedFrames);
+	Check(VariablePackets == FrameCount / 2 + 2, "variable frame rate static frames were skipped");
+
+	if (FailureCount > 0) {
+		fprintf(stderr, "%d checks failed.\n", FailureCount);
+		return 1;
+	}
+
+	printf("All checks passed.\n");
+	return 0;
+}